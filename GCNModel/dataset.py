@@ -4,10 +4,22 @@ import zlib
 import glob
 import os
 import csv
+import re
+import sys
 
 import torch
 from torch_geometric.data import Dataset, Data, download_url
 
+# The C++ matrix readers, when the MatrixGenerator module is built
+sys.path.append('./MatrixGenerator/lib')
+try:
+    from MatrixGenerator import read_matrix_market, read_binary_matrix
+except ImportError:
+    read_matrix_market = read_binary_matrix = None
+
+# Shard entries are addressed by a <shard>#<id>:<matrix> suffix, a '#' elsewhere in a path is no address
+shard_address = re.compile(r'#[0-9]+:(m1|m2|product)$')
+
 class SparseMatrixDataset(Dataset):
     def __init__(self, root, name):
         self.dataset_name = name
@@ -46,6 +58,11 @@ class SparseMatrixDataset(Dataset):
                     'prod_cols': row['product cols'],
                     'prod_nnz': row['product nnz'],
                     'prod_nnz_density': float(row['product nnz density']),
+                    # older csv files have no flop count or seed columns
+                    'prod_flops': row.get('product flops'),
+                    'prod_compression_ratio': row.get('product compression ratio'),
+                    'seed': row.get('seed'),
+                    'stream': row.get('stream'),
                     'm1_path': row['matrix 1 path'],
                     'm2_path': row['matrix 2 path'],
                     'prod_path': row['product path']
@@ -105,17 +122,37 @@ class SparseMatrixDataset(Dataset):
 
             torch.save(matrices_data, f"{self.processed_paths[0]}/{matrix_name}.pt")
 
+    def edge_index_from_indices(self, result, raw_path):
+        # the C++ readers return rows, cols and the 0-based row and col indices as int64 bytearrays, or an
+        # empty tuple when the file was rejected
+        if not result:
+            raise Exception("Failed to read matrix {}".format(raw_path))
+        rows, cols, row_bytes, col_bytes = result
+        if len(row_bytes) == 0:
+            return rows, cols, torch.empty((2, 0), dtype=torch.long)
+        return rows, cols, torch.stack([torch.frombuffer(row_bytes, dtype=torch.int64), torch.frombuffer(col_bytes, dtype=torch.int64)])
+
     def process_matrix(self, raw_path, prod_nnz_density):
         # if raw_path contains ./dataset, remove it
         # temporary solution. TODO: generate dataset csv without dataset path prefix
         if raw_path.startswith("./dataset"):
             raw_path = self.root + raw_path[9:]
 
-        with open(raw_path, "rb") as f:
-            print("\tRead matrix from ", raw_path)
-            lines = f.read().decode('utf-8').strip().split('\n')
-
-             # first line header, second line matrix rows cols nnzs
+        print("\tRead matrix from ", raw_path)
+        if shard_address.search(raw_path) or raw_path.endswith(".csc"):
+            # binary files and shard entries (<shard>#<id>:<matrix>) are checked and read by the C++ module,
+            # which wrote them
+            if read_binary_matrix is None:
+                raise Exception("Reading {} needs the MatrixGenerator module".format(raw_path))
+            rows, cols, edge_index = self.edge_index_from_indices(read_binary_matrix(raw_path), raw_path)
+        elif read_matrix_market is not None:
+            # parsed on all cores
+            rows, cols, edge_index = self.edge_index_from_indices(read_matrix_market(raw_path), raw_path)
+        else:
+            with open(raw_path, "rb") as f:
+                lines = f.read().decode('utf-8').strip().split('\n')
+
+            # first line header, second line matrix rows cols nnzs
             rows, cols, nnz = lines[1].split()
             lines = lines[2:]
 
@@ -124,39 +161,40 @@ class SparseMatrixDataset(Dataset):
             values = []
 
             for line in lines:
-                row, col, value = line.split() 
+                # pattern files have no value column, their entries are all 1
+                tokens = line.split()
                 # use 0-based indexing
-                row_indices.append(int(row) - 1) 
-                col_indices.append(int(col) - 1)
-                values.append(float(value))
+                row_indices.append(int(tokens[0]) - 1) 
+                col_indices.append(int(tokens[1]) - 1)
+                values.append(float(tokens[2]) if len(tokens) > 2 else 1.0)
 
             edge_index = torch.tensor([row_indices, col_indices], dtype=torch.long)
 
-            num_nodes = max(int(rows), int(cols))
+        num_nodes = max(int(rows), int(cols))
 
-            # print out length
-            print("edge_index length: ", edge_index.shape[1])
-            
-            # Calculate node feature as encoding of degree of each node
-            node_features = torch.zeros(num_nodes, self.num_node_features, dtype=torch.float)
-            div_term = 10000.0 ** (torch.arange(0.0, self.num_node_features, 2, dtype=torch.float) / self.num_node_features)
-            pos = torch.arange(0.0, num_nodes, 1, dtype=torch.float).unsqueeze(1)
-            node_features[:, 0::2] = torch.sin(pos / div_term)
-            node_features[:, 1::2] = torch.cos(pos / div_term)
-            x = node_features
-
-            y = torch.tensor([prod_nnz_density], dtype=torch.float)
-
-            data = Data(x=x, y=y, edge_index=edge_index, 
-                        num_nodes=num_nodes)
-            
-            print("x shape = {}".format(x.shape))
-            print("y shape = {}".format(y.shape))
+        # print out length
+        print("edge_index length: ", edge_index.shape[1])
+        
+        # Calculate node feature as encoding of degree of each node
+        node_features = torch.zeros(num_nodes, self.num_node_features, dtype=torch.float)
+        div_term = 10000.0 ** (torch.arange(0.0, self.num_node_features, 2, dtype=torch.float) / self.num_node_features)
+        pos = torch.arange(0.0, num_nodes, 1, dtype=torch.float).unsqueeze(1)
+        node_features[:, 0::2] = torch.sin(pos / div_term)
+        node_features[:, 1::2] = torch.cos(pos / div_term)
+        x = node_features
+
+        y = torch.tensor([prod_nnz_density], dtype=torch.float)
+
+        data = Data(x=x, y=y, edge_index=edge_index, 
+                    num_nodes=num_nodes)
+        
+        print("x shape = {}".format(x.shape))
+        print("y shape = {}".format(y.shape))
 
-            
-            print("Data object before return:", data)
+        
+        print("Data object before return:", data)
 
-            return data        
+        return data        
         
 
 # test code
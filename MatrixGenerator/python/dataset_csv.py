@@ -0,0 +1,26 @@
+# CSV rows of the dataset drivers, built from the tuple the generate_entry functions return
+import csv
+import os
+
+dataset_columns = ['timestamp', 'matrix 1 rows', 'matrix 1 cols', 'matrix 1 nnz', 'matrix 1 nnz density', 'matrix 2 rows', 'matrix 2 cols', 'matrix 2 nnz', 'matrix 2 nnz density', 'product rows', 'product cols', 'product nnz', 'product nnz density', 'product flops', 'product compression ratio', 'seed', 'stream', 'matrix 1 path', 'matrix 2 path', 'product path']
+
+def dataset_row(results):
+    # (timestamp, m1 path, rows, cols, nnz, m2 path, rows, cols, nnz, product path, rows, cols, nnz,
+    # nnz density, flops, compression ratio, seed, stream)
+    timestamp, m1_path, m1_rows, m1_cols, m1_nnz, m2_path, m2_rows, m2_cols, m2_nnz, prod_path, prod_rows, prod_cols, prod_nnz, prod_nnz_density, prod_flops, prod_compression_ratio, seed, stream = results
+    m1_nnz_density = m1_nnz / (m1_rows * m1_cols)
+    m2_nnz_density = m2_nnz / (m2_rows * m2_cols)
+
+    # use str(timestamp) to avoid scientific notation
+    return [str(timestamp), m1_rows, m1_cols, m1_nnz, m1_nnz_density, m2_rows, m2_cols, m2_nnz, m2_nnz_density, prod_rows, prod_cols, prod_nnz, prod_nnz_density, prod_flops, prod_compression_ratio, seed, stream, m1_path, m2_path, prod_path]
+
+def write_dataset_csv(dataset_name, dataset_entries):
+    # If directory does not exist, create it
+    if not os.path.exists('./dataset/csv'):
+        os.makedirs('./dataset/csv')
+
+    with open('./dataset/csv/' + dataset_name + '.csv', mode='w') as dataset_file:
+        dataset_writer = csv.writer(dataset_file, delimiter=',', quotechar='"', quoting=csv.QUOTE_MINIMAL)
+        dataset_writer.writerow(dataset_columns)
+        for entry in dataset_entries:
+            dataset_writer.writerow(entry)
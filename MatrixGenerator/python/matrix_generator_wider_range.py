@@ -1,10 +1,9 @@
 import sys
 sys.path.append('./MatrixGenerator/lib')
-from MatrixGenerator import generate_entry_square_matrices
+from MatrixGenerator import generate_entries_square_matrices
+from dataset_csv import dataset_row, write_dataset_csv
 
 import random
-import csv
-import os
 
 
 dataset_name = 'wider_range'
@@ -20,7 +19,15 @@ col_sparsity_range = [-10.0, 0.0]
 diag_sparsity_range = [-10.0, 0.0]
 symmetric = [True, False]
 
-dataset_entries = []
+# Pipeline threads per stage and the entries each queue holds, size them from the printed utilization
+generate_workers = 4
+multiply_workers = 2
+write_workers = 2
+queue_capacity = 8
+
+# Entry i uses stream i of one base seed, so (seed, stream) regenerates it
+base_seed = random.randrange(1, 2**63)
+entry_parameters = []
 
 for i in range(total_matrices):
     matrix_size = 10 ** random.uniform(matrix_size_range[0], matrix_size_range[1])
@@ -35,8 +42,7 @@ for i in range(total_matrices):
     col_sparsity_2 = 1.0 - 10.0 ** random.uniform(col_sparsity_range[0], col_sparsity_range[1])
     diag_sparsity_2 = 1.0 - 10.0 ** random.uniform(diag_sparsity_range[0], diag_sparsity_range[1])
 
-    results = generate_entry_square_matrices(dataset_path, 
-                    int(matrix_size),
+    entry_parameters.append((int(matrix_size),
                     max_nnz,
                     # matrix 1
                     nnz_sparsity_1,
@@ -49,40 +55,24 @@ for i in range(total_matrices):
                     row_sparsity_2,
                     col_sparsity_2,
                     diag_sparsity_2,
-                    random.choice(symmetric))
-    
+                    random.choice(symmetric),
+                    base_seed,
+                    i))
+
+entries, stages = generate_entries_square_matrices(dataset_path, entry_parameters, generate_workers, multiply_workers, write_workers, queue_capacity)
+
+for name in ['generate', 'multiply', 'write']:
+    stage = stages[name]
+    print(f"{name}: {stage['threads']} threads, {stage['utilization']:.0%} busy, {stage['starved_seconds']:.1f} s starved, {stage['blocked_seconds']:.1f} s blocked")
+print(f"{total_matrices} entries in {stages['wall_seconds']:.1f} s")
+
+dataset_entries = []
+
+for results in entries:
+    dataset_entries.append(dataset_row(results))
+
 
-    timestamp = results[0]
-    m1_path = results[1]
-    m1_rows = results[2]
-    m1_cols = results[3]
-    m1_nnz = results[4]
-    m1_nnz_density = m1_nnz / (m1_rows * m1_cols)
-    m2_path = results[5]
-    m2_rows = results[6]
-    m2_cols = results[7]
-    m2_nnz = results[8]
-    m2_nnz_density = m2_nnz / (m2_rows * m2_cols)
-    prod_path = results[9]
-    prod_rows = results[10]
-    prod_cols = results[11]
-    prod_nnz = results[12]
-    prod_nnz_density = results[13]
-
-    # use str(timestamp) to avoid scientific notation
-    dataset_entries.append([str(timestamp), m1_rows, m1_cols, m1_nnz, m1_nnz_density, m2_rows, m2_cols, m2_nnz, m2_nnz_density, prod_rows, prod_cols, prod_nnz, prod_nnz_density, m1_path, m2_path, prod_path])
-    print(i+1, 'of', total_matrices, 'done')
-
-
-# If directory does not exist, create it
-if not os.path.exists('./dataset/csv'):
-    os.makedirs('./dataset/csv')
-
-with open('./dataset/csv/'+dataset_name+'.csv', mode='w') as dataset_file:
-    dataset_writer = csv.writer(dataset_file, delimiter=',', quotechar='"', quoting=csv.QUOTE_MINIMAL)
-    dataset_writer.writerow(['timestamp', 'matrix 1 rows', 'matrix 1 cols', 'matrix 1 nnz', 'matrix 1 nnz density', 'matrix 2 rows', 'matrix 2 cols', 'matrix 2 nnz', 'matrix 2 nnz density', 'product rows', 'product cols', 'product nnz', 'product nnz density', 'matrix 1 path', 'matrix 2 path', 'product path'])
-    for entry in dataset_entries:
-        dataset_writer.writerow(entry)
+write_dataset_csv(dataset_name, dataset_entries)
 
 print('Done!')
 
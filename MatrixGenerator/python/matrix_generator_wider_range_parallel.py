@@ -1,12 +1,12 @@
 import sys
 import random
-import csv
 import os
 from concurrent.futures import ProcessPoolExecutor, as_completed
 from tqdm import tqdm
 
 sys.path.append('./MatrixGenerator/lib')
-from MatrixGenerator import generate_entry_square_matrices
+from MatrixGenerator import generate_entry_square_matrices, set_shard
+from dataset_csv import dataset_row, write_dataset_csv
 
 dataset_name = 'wider_range'
 dataset_path = './dataset/' + dataset_name
@@ -21,18 +21,31 @@ col_sparsity_range = [-10.0, 0.0]
 diag_sparsity_range = [-10.0, 0.0]
 symmetric = [True, False]
 
-def generate_dataset_entry(dataset_path, max_nnz, matrix_size_range, nnz_sparsity_range, row_sparsity_range, col_sparsity_range, diag_sparsity_range, symmetric):
-    matrix_size = 10 ** random.uniform(matrix_size_range[0], matrix_size_range[1])
+# Entry i is generated from (base_seed, i) alone, so any entry can be regenerated from the CSV
+base_seed = random.randrange(1, 2 ** 63)
 
-    nnz_sparsity_1 = 1.0 - 10 ** random.uniform(nnz_sparsity_range[0], nnz_sparsity_range[1])
-    row_sparsity_1 = 1.0 - 10.0 ** random.uniform(row_sparsity_range[0], row_sparsity_range[1])
-    col_sparsity_1 = 1.0 - 10.0 ** random.uniform(col_sparsity_range[0], col_sparsity_range[1])
-    diag_sparsity_1 = 1.0 - 10.0 ** random.uniform(diag_sparsity_range[0], diag_sparsity_range[1])
+# Each worker appends its entries to a shard of its own rather than writing three files per entry. Workers
+# exit without closing their shard, so readers find its entries by walking the records.
+def open_worker_shard(dataset_path, base_seed):
+    shard_path = f'{dataset_path}/shard_{base_seed}_{os.getpid()}.shd'
+    if not set_shard(shard_path):
+        raise Exception(f'Failed to open shard {shard_path}')
 
-    nnz_sparsity_2 = 1.0 - 10.0 ** random.uniform(nnz_sparsity_range[0], nnz_sparsity_range[1])
-    row_sparsity_2 = 1.0 - 10.0 ** random.uniform(row_sparsity_range[0], row_sparsity_range[1])
-    col_sparsity_2 = 1.0 - 10.0 ** random.uniform(col_sparsity_range[0], col_sparsity_range[1])
-    diag_sparsity_2 = 1.0 - 10.0 ** random.uniform(diag_sparsity_range[0], diag_sparsity_range[1])
+def generate_dataset_entry(base_seed, index, dataset_path, max_nnz, matrix_size_range, nnz_sparsity_range, row_sparsity_range, col_sparsity_range, diag_sparsity_range, symmetric):
+    # Forked workers share the parent's random state, so parameters come from a per-entry generator
+    rng = random.Random(f'{base_seed}-{index}')
+
+    matrix_size = 10 ** rng.uniform(matrix_size_range[0], matrix_size_range[1])
+
+    nnz_sparsity_1 = 1.0 - 10 ** rng.uniform(nnz_sparsity_range[0], nnz_sparsity_range[1])
+    row_sparsity_1 = 1.0 - 10.0 ** rng.uniform(row_sparsity_range[0], row_sparsity_range[1])
+    col_sparsity_1 = 1.0 - 10.0 ** rng.uniform(col_sparsity_range[0], col_sparsity_range[1])
+    diag_sparsity_1 = 1.0 - 10.0 ** rng.uniform(diag_sparsity_range[0], diag_sparsity_range[1])
+
+    nnz_sparsity_2 = 1.0 - 10.0 ** rng.uniform(nnz_sparsity_range[0], nnz_sparsity_range[1])
+    row_sparsity_2 = 1.0 - 10.0 ** rng.uniform(row_sparsity_range[0], row_sparsity_range[1])
+    col_sparsity_2 = 1.0 - 10.0 ** rng.uniform(col_sparsity_range[0], col_sparsity_range[1])
+    diag_sparsity_2 = 1.0 - 10.0 ** rng.uniform(diag_sparsity_range[0], diag_sparsity_range[1])
 
     results = generate_entry_square_matrices(dataset_path, 
                     int(matrix_size),
@@ -42,53 +55,29 @@ def generate_dataset_entry(dataset_path, max_nnz, matrix_size_range, nnz_sparsit
                     row_sparsity_1,
                     col_sparsity_1,
                     diag_sparsity_1,
-                    random.choice(symmetric),
+                    rng.choice(symmetric),
                     # matrix 2
                     nnz_sparsity_2,
                     row_sparsity_2,
                     col_sparsity_2,
                     diag_sparsity_2,
-                    random.choice(symmetric))
-
-    timestamp = results[0]
-    m1_path = results[1]
-    m1_rows = results[2]
-    m1_cols = results[3]
-    m1_nnz = results[4]
-    m1_nnz_density = m1_nnz / (m1_rows * m1_cols)
-    m2_path = results[5]
-    m2_rows = results[6]
-    m2_cols = results[7]
-    m2_nnz = results[8]
-    m2_nnz_density = m2_nnz / (m2_rows * m2_cols)
-    prod_path = results[9]
-    prod_rows = results[10]
-    prod_cols = results[11]
-    prod_nnz = results[12]
-    prod_nnz_density = results[13]
-
-    # use str(timestamp) to avoid scientific notation
-    return [str(timestamp), m1_rows, m1_cols, m1_nnz, m1_nnz_density, m2_rows, m2_cols, m2_nnz, m2_nnz_density, prod_rows, prod_cols, prod_nnz, prod_nnz_density, m1_path, m2_path, prod_path]
+                    rng.choice(symmetric),
+                    base_seed,
+                    index)
 
-dataset_entries = []
+    return dataset_row(results)
 
-# If directory does not exist, create it
-if not os.path.exists('./dataset/csv'):
-    os.makedirs('./dataset/csv')
+dataset_entries = []
 
 # Use ProcessPoolExecutor for parallel execution
-with ProcessPoolExecutor(max_workers=os.cpu_count()) as executor:
-    futures = [executor.submit(generate_dataset_entry, dataset_path, max_nnz, matrix_size_range, nnz_sparsity_range, row_sparsity_range, col_sparsity_range, diag_sparsity_range, symmetric) for _ in range(total_matrices)]
+with ProcessPoolExecutor(max_workers=os.cpu_count(), initializer=open_worker_shard, initargs=(dataset_path, base_seed)) as executor:
+    futures = [executor.submit(generate_dataset_entry, base_seed, index, dataset_path, max_nnz, matrix_size_range, nnz_sparsity_range, row_sparsity_range, col_sparsity_range, diag_sparsity_range, symmetric) for index in range(total_matrices)]
 
     with tqdm(total=total_matrices, file=sys.stdout) as pbar:
         for future in as_completed(futures):
             dataset_entries.append(future.result())
             pbar.update(1)
 
-with open('./dataset/csv/' + dataset_name + '.csv', mode='w') as dataset_file:
-    dataset_writer = csv.writer(dataset_file, delimiter=',', quotechar='"', quoting=csv.QUOTE_MINIMAL)
-    dataset_writer.writerow(['timestamp', 'matrix 1 rows', 'matrix 1 cols', 'matrix 1 nnz', 'matrix 1 nnz density', 'matrix 2 rows', 'matrix 2 cols', 'matrix 2 nnz', 'matrix 2 nnz density', 'product rows', 'product cols', 'product nnz', 'product nnz density', 'matrix 1 path', 'matrix 2 path', 'product path'])
-    for entry in dataset_entries:
-        dataset_writer.writerow(entry)
+write_dataset_csv(dataset_name, dataset_entries)
 
 print('Done!')
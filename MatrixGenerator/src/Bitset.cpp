@@ -0,0 +1,88 @@
+#include "Bitset.h"
+
+// The AVX-512 and AVX2 kernels are always compiled, each for its own target, and picked at run time, so
+// the module runs on any x86-64 CPU without being built for the host
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define BITSET_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+static int64_t popcount_words_scalar(const uint64_t *words, int64_t count)
+{
+    int64_t total = 0;
+    for (int64_t i = 0; i < count; i++)
+    {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+#ifdef BITSET_X86_DISPATCH
+
+__attribute__((target("avx512f,avx512vpopcntdq")))
+static int64_t popcount_words_avx512(const uint64_t *words, int64_t count)
+{
+    __m512i sum = _mm512_setzero_si512();
+    int64_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_loadu_si512(words + i)));
+    }
+    if (i < count)
+    {
+        __mmask8 tail = static_cast<__mmask8>((1u << (count - i)) - 1);
+        sum = _mm512_add_epi64(sum, _mm512_popcnt_epi64(_mm512_maskz_loadu_epi64(tail, words + i)));
+    }
+    return _mm512_reduce_add_epi64(sum);
+}
+
+// Per-byte popcount through a 4-bit lookup table, summed into the four 64-bit lanes
+__attribute__((target("avx2")))
+static inline __m256i popcount_lanes(__m256i v)
+{
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low_mask = _mm256_set1_epi8(0x0f);
+    __m256i lo = _mm256_and_si256(v, low_mask);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_mask);
+    __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    return _mm256_sad_epu8(bytes, _mm256_setzero_si256());
+}
+
+__attribute__((target("avx2")))
+static int64_t popcount_words_avx2(const uint64_t *words, int64_t count)
+{
+    __m256i sum = _mm256_setzero_si256();
+    int64_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        sum = _mm256_add_epi64(sum, popcount_lanes(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i))));
+    }
+
+    int64_t total = _mm256_extract_epi64(sum, 0) + _mm256_extract_epi64(sum, 1) + _mm256_extract_epi64(sum, 2) + _mm256_extract_epi64(sum, 3);
+    for (; i < count; i++)
+    {
+        total += __builtin_popcountll(words[i]);
+    }
+    return total;
+}
+
+#endif
+
+int64_t popcount_words(const uint64_t *words, int64_t count)
+{
+#ifdef BITSET_X86_DISPATCH
+    static const auto kernel = []()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512vpopcntdq"))
+        {
+            return popcount_words_avx512;
+        }
+        return __builtin_cpu_supports("avx2") ? popcount_words_avx2 : popcount_words_scalar;
+    }();
+    return kernel(words, count);
+#else
+    return popcount_words_scalar(words, count);
+#endif
+}
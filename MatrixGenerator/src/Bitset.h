@@ -0,0 +1,25 @@
+#ifndef BITSET_H
+#define BITSET_H
+
+#include <cstdint>
+
+inline int64_t bitset_words(int64_t bits)
+{
+    return (bits + 63) >> 6;
+}
+
+inline bool bitset_test(const uint64_t *words, int64_t bit)
+{
+    return (words[bit >> 6] >> (bit & 63)) & 1;
+}
+
+inline void bitset_set(uint64_t *words, int64_t bit)
+{
+    words[bit >> 6] |= uint64_t(1) << (bit & 63);
+}
+
+// Total number of set bits in words[0, count).
+// Uses AVX-512 VPOPCNTDQ or an AVX2 nibble lookup when the CPU has them, scalar popcount otherwise.
+int64_t popcount_words(const uint64_t *words, int64_t count);
+
+#endif // BITSET_H
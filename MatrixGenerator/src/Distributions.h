@@ -0,0 +1,175 @@
+#ifndef DISTRIBUTIONS_H
+#define DISTRIBUTIONS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <random>
+#include <variant>
+
+#include "Random.h"
+
+// The distributions select_random_generator picks from. Each is a concrete type with an inline draw and
+// a batched fill, and RandomGenerator holds one of them; callers visit it once around a sampling loop so
+// the loop is compiled per distribution instead of paying an indirect call per draw.
+
+// Uniform double in (0, 1], safe to take the logarithm of
+inline double uniform_open_closed(RandomEngine &gen)
+{
+    return (static_cast<double>(gen() >> 11) + 1.0) * 0x1.0p-53;
+}
+
+// Uniform over [min_val, max_val]
+struct UniformGenerator
+{
+    int64_t min_val, max_val;
+
+    int64_t operator()(RandomEngine &gen) const
+    {
+        return min_val + static_cast<int64_t>(uniform_below(gen, static_cast<uint64_t>(max_val - min_val) + 1));
+    }
+
+    void fill(RandomEngine &gen, int64_t *out, int64_t n) const
+    {
+        const uint64_t span = static_cast<uint64_t>(max_val - min_val) + 1;
+        for (int64_t i = 0; i < n; i++)
+        {
+            out[i] = min_val + static_cast<int64_t>(uniform_below(gen, span));
+        }
+    }
+};
+
+// Normal around the middle of [min_val, max_val] with a quarter of the range as deviation, truncated
+// towards zero and clamped to the range
+struct NormalGenerator
+{
+    int64_t min_val, max_val;
+    std::normal_distribution<double> dist;
+
+    NormalGenerator(int64_t min_val, int64_t max_val)
+        : min_val(min_val), max_val(max_val), dist((max_val + min_val) / 2, (max_val - min_val) / 4)
+    {
+    }
+
+    int64_t operator()(RandomEngine &gen)
+    {
+        return std::max(min_val, std::min(max_val, static_cast<int64_t>(dist(gen))));
+    }
+
+    void fill(RandomEngine &gen, int64_t *out, int64_t n)
+    {
+        for (int64_t i = 0; i < n; i++)
+        {
+            out[i] = (*this)(gen);
+        }
+    }
+};
+
+// Geometric from 0 covering 95% of the range length, clamped to [min_val, max_val]
+struct GeometricGenerator
+{
+    int64_t min_val, max_val;
+    double log_failure;
+
+    GeometricGenerator(int64_t min_val, int64_t max_val)
+        : min_val(min_val), max_val(max_val)
+    {
+        double desired_coverage = 0.95;
+        double p = 1 - std::pow(1.0 - desired_coverage, 1.0 / (max_val - min_val + 1));
+        log_failure = std::log1p(-p);
+    }
+
+    // Inversion: floor(log(u) / log(1 - p)) for u uniform in (0, 1]
+    int64_t operator()(RandomEngine &gen) const
+    {
+        return clamp(std::floor(std::log(uniform_open_closed(gen)) / log_failure));
+    }
+
+    // The logarithms of a batch run in one branch-free loop
+    void fill(RandomEngine &gen, int64_t *out, int64_t n) const
+    {
+        constexpr int64_t batch = 64;
+        double u[batch];
+        for (int64_t begin = 0; begin < n; begin += batch)
+        {
+            const int64_t count = std::min(batch, n - begin);
+            for (int64_t i = 0; i < count; i++)
+            {
+                u[i] = uniform_open_closed(gen);
+            }
+            for (int64_t i = 0; i < count; i++)
+            {
+                u[i] = std::floor(std::log(u[i]) / log_failure);
+            }
+            for (int64_t i = 0; i < count; i++)
+            {
+                out[begin + i] = clamp(u[i]);
+            }
+        }
+    }
+
+private:
+    int64_t clamp(double value) const
+    {
+        // Large draws saturate before the cast
+        return std::max(min_val, std::min(max_val, static_cast<int64_t>(std::min(value, 9.0e18))));
+    }
+};
+
+// Failures before each success of Bernoulli(p) trials, the gaps bernoulli_positions skips over. Gaps
+// come in batches of up to 64 off the engine's buffered output and stay doubles, so a huge gap cannot
+// overflow the position it is added to. The first batch covers the hits expected over trials with a
+// margin of two standard deviations and later ones double, so callers walking many short ranges do not
+// pay for gaps they never use.
+class GeometricGaps
+{
+public:
+    GeometricGaps(double p, int64_t trials)
+        : log_failure(std::log1p(-p))
+    {
+        const double expected = p * std::max(int64_t(0), trials);
+        next_size = static_cast<int>(std::min<double>(batch, expected + 2 * std::sqrt(expected) + 2));
+    }
+
+    double operator()(RandomEngine &gen)
+    {
+        if (position == size)
+        {
+            size = next_size;
+            next_size = std::min(batch, 2 * size);
+            for (int i = 0; i < size; i++)
+            {
+                gaps[i] = uniform_open_closed(gen);
+            }
+            for (int i = 0; i < size; i++)
+            {
+                gaps[i] = std::floor(std::log(gaps[i]) / log_failure);
+            }
+            position = 0;
+        }
+        return gaps[position++];
+    }
+
+private:
+    static constexpr int batch = 64;
+
+    double log_failure;
+    double gaps[batch];
+    int size = 0;
+    int next_size;
+    int position = 0;
+};
+
+using RandomGenerator = std::variant<UniformGenerator, NormalGenerator, GeometricGenerator>;
+
+inline int64_t draw_random(RandomGenerator &generator, RandomEngine &gen)
+{
+    return std::visit([&](auto &g) { return g(gen); }, generator);
+}
+
+inline void fill_random(RandomGenerator &generator, RandomEngine &gen, int64_t *out, int64_t n)
+{
+    std::visit([&](auto &g) { g.fill(gen, out, n); }, generator);
+}
+
+#endif // DISTRIBUTIONS_H
@@ -1,154 +1,748 @@
 #include "EntryGenerator.h"
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <filesystem>
 #include <iostream>
+#include <mutex>
 
+#include "Pipeline.h"
+#include "Shard.h"
+#include "SparseProduct.h"
 #include "Utilities.h"
 
-DataSetEntry generate_entry_helper(int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, 
-                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m1_matrix_generator,
-                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator)
+static bool symbolic_product_enabled = false;
+static ProductKernel product_kernel = ProductKernel::Auto;
+static int product_threads = 1;
+static bool product_log_enabled = false;
+static int generator_threads = 1;
+static bool binary_format_enabled = false;
+static ShardWriter shard_writer;
+static std::mutex shard_mutex;
+
+void set_symbolic_product(bool enabled)
 {
-    DataSetEntry entry;
-    entry.m1 = m1_matrix_generator();
-    entry.m2 = m2_matrix_generator();
+    symbolic_product_enabled = enabled;
+}
+
+bool set_product_kernel(std::string name)
+{
+    if (!parse_product_kernel(name, product_kernel))
+    {
+        std::cerr << "Unknown product kernel " << name << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void set_product_threads(int num_threads)
+{
+    product_threads = num_threads;
+}
+
+void set_generator_threads(int num_threads)
+{
+    generator_threads = num_threads;
+}
+
+void set_product_log(bool enabled)
+{
+    product_log_enabled = enabled;
+}
+
+bool set_matrix_format(std::string name)
+{
+    if (name != "mtx" && name != "binary")
+    {
+        std::cerr << "Unknown matrix format " << name << std::endl;
+        return false;
+    }
+    binary_format_enabled = name == "binary";
+    return true;
+}
+
+bool set_shard(std::string path)
+{
+    std::lock_guard<std::mutex> lock(shard_mutex);
+    if (path.empty())
+    {
+        return shard_writer.close();
+    }
+    std::filesystem::path parent = std::filesystem::path(path).parent_path();
+    if (!parent.empty())
+    {
+        std::filesystem::create_directories(parent);
+    }
+    return shard_writer.open(path);
+}
+
+// Saves in the selected format under stem plus its extension, which is returned in path
+static bool save_entry_matrix(std::filesystem::path &path, const std::string &stem, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
+{
+    if (binary_format_enabled)
+    {
+        path = stem + ".csc";
+        return save_matrix_binary(path, matrix);
+    }
+    path = stem + ".mtx";
+    return save_matrix(path, matrix);
+}
+
+// Resolves the automatic kernel for this product, logging the choice and the statistics behind it
+static ProductKernel resolve_product_kernel(const Eigen::SparseMatrix<bool, 0, int64_t> &m1, const Eigen::SparseMatrix<bool, 0, int64_t> &m2)
+{
+    if (product_kernel != ProductKernel::Auto)
+    {
+        return product_kernel;
+    }
+
+    std::string reason;
+    ProductStatistics statistics = product_statistics(m1, m2);
+    ProductKernel kernel = select_product_kernel(statistics, reason);
+    if (product_log_enabled)
+    {
+        std::clog << "Product " << statistics.rows << "x" << statistics.inner_size << "x" << statistics.cols
+                  << ", flops " << statistics.flops << ", max column flops " << statistics.max_col_flops
+                  << ", column estimate avg " << statistics.avg_col_estimate << " max " << statistics.max_col_estimate
+                  << ", inner dimension " << statistics.inner_dimension
+                  << ": " << product_kernel_name(kernel) << " kernel, " << reason << std::endl;
+    }
+    return kernel;
+}
+
+// generate_matrix, or its parallel variant when generator threads are set
+static Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_threaded(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed, uint64_t stream)
+{
+    if (generator_threads == 1)
+    {
+        return generate_matrix(rows, cols, max_nnz, nnz_sparsity, row_sparsity, col_sparsity, diag_sparsity, symmetric, seed, stream);
+    }
+    return generate_matrix_parallel(rows, cols, max_nnz, nnz_sparsity, row_sparsity, col_sparsity, diag_sparsity, symmetric, seed, stream, generator_threads);
+}
 
+static Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows_threaded(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity, uint64_t seed, uint64_t stream)
+{
+    if (generator_threads == 1)
+    {
+        return generate_matrix_multiple_rows(rows, cols, max_nnz, nnz_sparsity, col_sparsity, seed, stream);
+    }
+    return generate_matrix_multiple_rows_parallel(rows, cols, max_nnz, nnz_sparsity, col_sparsity, seed, stream, generator_threads);
+}
+
+// Fills in the densities and the product of an entry whose matrices are generated, computing the product
+// on num_threads threads
+static void complete_entry(DataSetEntry &entry, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int num_threads)
+{
     entry.m1_nnz_density = static_cast<float>(entry.m1.nonZeros()) / (m1_rows * m1_cols_and_m2_rows);
     entry.m2_nnz_density = static_cast<float>(entry.m2.nonZeros()) / (m1_cols_and_m2_rows * m2_cols);
 
-    entry.prod = entry.m1 * entry.m2;
+    // Low-rank products are counted, or built, in closed form without running SpGEMM
+    if (symbolic_product_enabled)
+    {
+        entry.prod = Eigen::SparseMatrix<bool, 0, int64_t>(m1_rows, m2_cols);
+        if (!analytic_product_nnz(entry.m1, entry.m2, entry.product_nnz))
+        {
+            entry.product_nnz = symbolic_product_nnz(entry.m1, entry.m2, num_threads);
+        }
+    }
+    else
+    {
+        if (!analytic_product(entry.m1, entry.m2, entry.prod))
+        {
+            entry.prod = sparse_product(entry.m1, entry.m2, resolve_product_kernel(entry.m1, entry.m2), num_threads);
+        }
+        entry.product_nnz = entry.prod.nonZeros();
+    }
 
-    entry.product_nnz_density = static_cast<float>(entry.prod.nonZeros()) / (m1_rows * m2_cols);
+    entry.product_nnz_density = static_cast<float>(entry.product_nnz) / (m1_rows * m2_cols);
 
-    return entry;
+    // An empty product did no work, so it has nothing to compress
+    entry.product_flops = product_flops(entry.m1, entry.m2);
+    entry.product_compression_ratio = entry.product_nnz > 0 ? static_cast<float>(entry.product_flops) / entry.product_nnz : 1.0f;
 }
 
-boost::python::tuple generate_entry(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols,
+DataSetEntry generate_entry_helper(int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, 
                                     const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m1_matrix_generator,
                                     const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator)
 {
-    std::filesystem::create_directories(path);
+    DataSetEntry entry;
+    entry.m1 = m1_matrix_generator();
+    entry.m2 = m2_matrix_generator();
 
-    auto entry = generate_entry_helper(m1_rows, m1_cols_and_m2_rows, m2_cols, m1_matrix_generator, m2_matrix_generator);
+    complete_entry(entry, m1_rows, m1_cols_and_m2_rows, m2_cols, product_threads);
 
-    std::string timestamp = current_timestamp();
+    return entry;
+}
 
-    std::filesystem::path m1_path = path + "/" + timestamp + "_m1.mtx";
-    if (!save_matrix(m1_path, entry.m1))
-    {
-        std::cerr << "Failed to save matrix 1 to " << m1_path << std::endl;
-    }
+// What an entry reports once saved, kept apart from its matrices so they can be freed after writing
+struct EntryRecord
+{
+    std::string timestamp;
+    std::filesystem::path m1_path, m2_path, product_path;
+    int64_t m1_rows, m1_cols, m1_nnz, m2_rows, m2_cols, m2_nnz, product_rows, product_cols, product_nnz, product_flops;
+    float product_nnz_density, product_compression_ratio;
+    uint64_t seed, stream;
+};
 
-    std::filesystem::path m2_path = path + "/" + timestamp + "_m2.mtx";
-    if (!save_matrix(m2_path, entry.m2))
+// Saves the entry to the open shard or as separate files under path, named after the (seed, stream) pair
+// that regenerates it so that concurrent writers never pick the same name
+static EntryRecord save_entry(const std::string &path, const DataSetEntry &entry, uint64_t seed, uint64_t stream)
+{
+    EntryRecord record;
+    record.timestamp = current_timestamp();
+
+    // Pipeline writers share the shard, which is also checked under the lock
+    std::unique_lock<std::mutex> lock(shard_mutex);
+    if (shard_writer.is_open())
     {
-        std::cerr << "Failed to save matrix 2 to " << m2_path << std::endl;
+        // Shard entries are addressed as <shard>#<id>:<matrix>
+        int64_t id = shard_writer.append(entry, !symbolic_product_enabled, seed, stream);
+        if (id >= 0)
+        {
+            std::string prefix = shard_writer.path().string() + "#" + std::to_string(id) + ":";
+            record.m1_path = prefix + "m1";
+            record.m2_path = prefix + "m2";
+            if (!symbolic_product_enabled)
+            {
+                record.product_path = prefix + "product";
+            }
+        }
     }
-
-    std::filesystem::path product_path = path + "/" + timestamp + "_product.mtx";
-    if (!save_matrix(product_path, entry.prod))
+    else
     {
-        std::cerr << "Failed to save product to " << product_path << std::endl;
+        lock.unlock();
+        const std::string stem = path + "/" + std::to_string(seed) + "_" + std::to_string(stream);
+        if (!save_entry_matrix(record.m1_path, stem + "_m1", entry.m1))
+        {
+            std::cerr << "Failed to save matrix 1 to " << record.m1_path << std::endl;
+        }
+
+        if (!save_entry_matrix(record.m2_path, stem + "_m2", entry.m2))
+        {
+            std::cerr << "Failed to save matrix 2 to " << record.m2_path << std::endl;
+        }
+
+        // Symbolic entries have no product to save, so an empty path is reported
+        if (!symbolic_product_enabled && !save_entry_matrix(record.product_path, stem + "_product", entry.prod))
+        {
+            std::cerr << "Failed to save product to " << record.product_path << std::endl;
+        }
     }
 
+    record.m1_rows = entry.m1.rows();
+    record.m1_cols = entry.m1.cols();
+    record.m1_nnz = entry.m1.nonZeros();
+    record.m2_rows = entry.m2.rows();
+    record.m2_cols = entry.m2.cols();
+    record.m2_nnz = entry.m2.nonZeros();
+    record.product_rows = entry.prod.rows();
+    record.product_cols = entry.prod.cols();
+    record.product_nnz = entry.product_nnz;
+    record.product_flops = entry.product_flops;
+    record.product_nnz_density = entry.product_nnz_density;
+    record.product_compression_ratio = entry.product_compression_ratio;
+    record.seed = seed;
+    record.stream = stream;
+    return record;
+}
+
+static boost::python::tuple entry_tuple(const EntryRecord &record)
+{
     return boost::python::make_tuple(
-        timestamp,
-        m1_path.string(), 
-        entry.m1.rows(),
-        entry.m1.cols(),
-        entry.m1.nonZeros(),
-        m2_path.string(), 
-        entry.m2.rows(),
-        entry.m2.cols(),
-        entry.m2.nonZeros(),
-        product_path.string(), 
-        entry.prod.rows(),
-        entry.prod.cols(),
-        entry.prod.nonZeros(),
-        entry.product_nnz_density);
+        record.timestamp,
+        record.m1_path.string(), 
+        record.m1_rows,
+        record.m1_cols,
+        record.m1_nnz,
+        record.m2_path.string(), 
+        record.m2_rows,
+        record.m2_cols,
+        record.m2_nnz,
+        record.product_path.string(), 
+        record.product_rows,
+        record.product_cols,
+        record.product_nnz,
+        record.product_nnz_density,
+        record.product_flops,
+        record.product_compression_ratio,
+        record.seed,
+        record.stream);
 }
 
-boost::python::tuple generate_entry_rectangle_matrices(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t max_nnz, 
+boost::python::tuple generate_entry(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols,
+                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m1_matrix_generator,
+                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator,
+                                    uint64_t seed, uint64_t stream)
+{
+    std::filesystem::create_directories(path);
+
+    auto entry = generate_entry_helper(m1_rows, m1_cols_and_m2_rows, m2_cols, m1_matrix_generator, m2_matrix_generator);
+
+    return entry_tuple(save_entry(path, entry, seed, stream));
+}
+
+// The dimensions and matrix generators of an entry, which run without touching Python
+struct EntryJob
+{
+    int64_t m1_rows, m1_cols_and_m2_rows, m2_cols;
+    std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> m1_generator, m2_generator;
+    uint64_t seed, stream;
+};
+
+static EntryJob rectangle_entry_job(int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t max_nnz, 
                                     float m1_nnz_sparsity, float m1_row_sparsity, float m1_col_sparsity, float m1_diag_sparsity, bool m1_symmetric,
-                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric)
+                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric,
+                                    uint64_t seed, uint64_t stream)
 {
+    seed = resolve_seed(seed);
+
     auto m1_generator = [=]() { 
-        return generate_matrix(m1_rows, m1_cols_and_m2_rows, max_nnz, m1_nnz_sparsity, m1_row_sparsity, m1_col_sparsity, m1_diag_sparsity, m1_symmetric);
+        return generate_matrix_threaded(m1_rows, m1_cols_and_m2_rows, max_nnz, m1_nnz_sparsity, m1_row_sparsity, m1_col_sparsity, m1_diag_sparsity, m1_symmetric, seed, sub_stream(stream, 0));
     };
     auto m2_generator = [=]() {
-        return generate_matrix(m1_cols_and_m2_rows, m2_cols, max_nnz, m2_nnz_sparsity, m2_row_sparsity, m2_col_sparsity, m2_diag_sparsity, m2_symmetric);
+        return generate_matrix_threaded(m1_cols_and_m2_rows, m2_cols, max_nnz, m2_nnz_sparsity, m2_row_sparsity, m2_col_sparsity, m2_diag_sparsity, m2_symmetric, seed, sub_stream(stream, 1));
     };
 
-    return generate_entry(path, m1_rows,m1_cols_and_m2_rows, m2_cols, m1_generator, m2_generator);
+    return EntryJob{m1_rows, m1_cols_and_m2_rows, m2_cols, m1_generator, m2_generator, seed, stream};
+}
+
+boost::python::tuple generate_entry_rectangle_matrices(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t max_nnz, 
+                                    float m1_nnz_sparsity, float m1_row_sparsity, float m1_col_sparsity, float m1_diag_sparsity, bool m1_symmetric,
+                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric,
+                                    uint64_t seed, uint64_t stream)
+{
+    EntryJob job = rectangle_entry_job(m1_rows, m1_cols_and_m2_rows, m2_cols, max_nnz, 
+                                    m1_nnz_sparsity, m1_row_sparsity, m1_col_sparsity, m1_diag_sparsity, m1_symmetric,
+                                    m2_nnz_sparsity, m2_row_sparsity, m2_col_sparsity, m2_diag_sparsity, m2_symmetric,
+                                    seed, stream);
+
+    return generate_entry(path, job.m1_rows, job.m1_cols_and_m2_rows, job.m2_cols, job.m1_generator, job.m2_generator, job.seed, job.stream);
 }
 
 boost::python::tuple generate_entry_square_matrices(std::string path, int64_t size, int64_t max_nnz,
                                     float m1_nnz_sparsity, float m1_row_sparsity, float m1_col_sparsity, float m1_diag_sparsity, bool m1_symmetric,
-                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric)
+                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric,
+                                    uint64_t seed, uint64_t stream)
 {
     return generate_entry_rectangle_matrices(path, size, size, size, max_nnz, 
                                     m1_nnz_sparsity, m1_row_sparsity, m1_col_sparsity, m1_diag_sparsity, m1_symmetric,
-                                    m2_nnz_sparsity, m2_row_sparsity, m2_col_sparsity, m2_diag_sparsity, m2_symmetric);
+                                    m2_nnz_sparsity, m2_row_sparsity, m2_col_sparsity, m2_diag_sparsity, m2_symmetric,
+                                    seed, stream);
+}
+
+// Releases the GIL while alive, so other Python threads run while the pipeline works
+class ReleasedGil
+{
+public:
+    ReleasedGil() : state(PyEval_SaveThread()) {}
+    ~ReleasedGil() { PyEval_RestoreThread(state); }
+
+private:
+    PyThreadState *state;
+};
+
+// Reads the parameter tuples of a batch: the arguments of generate_entry_rectangle_matrices after path, or
+// of generate_entry_square_matrices when square, with seed and stream optional. Returns false on a bad tuple.
+static bool entry_jobs_from_parameters(const boost::python::list &parameters, bool square, std::vector<EntryJob> &jobs)
+{
+    using boost::python::extract;
+
+    const int dims = square ? 1 : 3;
+    const int64_t count = boost::python::len(parameters);
+    for (int64_t i = 0; i < count; i++)
+    {
+        extract<boost::python::tuple> is_tuple(parameters[i]);
+        const int64_t size = is_tuple.check() ? boost::python::len(parameters[i]) : -1;
+        if (size != dims + 11 && size != dims + 13)
+        {
+            std::cerr << "Entry " << i << " needs a tuple of " << dims + 11 << " or " << dims + 13 << " parameters" << std::endl;
+            return false;
+        }
+
+        boost::python::tuple p = is_tuple();
+        const int64_t m1_rows = extract<int64_t>(p[0]);
+        const int64_t m1_cols_and_m2_rows = square ? m1_rows : extract<int64_t>(p[1]);
+        const int64_t m2_cols = square ? m1_rows : extract<int64_t>(p[2]);
+        const uint64_t seed = size == dims + 13 ? extract<uint64_t>(p[dims + 11])() : 0;
+        const uint64_t stream = size == dims + 13 ? extract<uint64_t>(p[dims + 12])() : 0;
+
+        jobs.push_back(rectangle_entry_job(m1_rows, m1_cols_and_m2_rows, m2_cols, extract<int64_t>(p[dims]),
+                                    extract<float>(p[dims + 1]), extract<float>(p[dims + 2]), extract<float>(p[dims + 3]), extract<float>(p[dims + 4]), extract<bool>(p[dims + 5]),
+                                    extract<float>(p[dims + 6]), extract<float>(p[dims + 7]), extract<float>(p[dims + 8]), extract<float>(p[dims + 9]), extract<bool>(p[dims + 10]),
+                                    seed, stream));
+    }
+    return true;
+}
+
+// Runs the jobs through the generate, multiply and write stages and returns their entries in job order,
+// plus the statistics of every stage
+static boost::python::tuple generate_entries(const std::string &path, const std::vector<EntryJob> &jobs,
+                                    int generate_workers, int multiply_workers, int write_workers, int queue_capacity)
+{
+    if (queue_capacity <= 0)
+    {
+        std::cerr << "Queue capacity must be positive, got " << queue_capacity << std::endl;
+        return boost::python::make_tuple(boost::python::list(), boost::python::dict());
+    }
+
+    // The multiply workers share the product threads instead of each starting as many
+    const int total_product_threads = product_threads > 0 ? product_threads : default_thread_count();
+    const int multiply_threads = multiply_workers > 0 ? multiply_workers : default_thread_count();
+    const int entry_product_threads = std::max(1, total_product_threads / multiply_threads);
+
+    std::filesystem::create_directories(path);
+
+    struct PipelineItem
+    {
+        int64_t index = 0;
+        DataSetEntry entry;
+    };
+
+    std::vector<EntryRecord> records(jobs.size());
+    PipelineStatistics statistics;
+    {
+        ReleasedGil released;
+
+        std::function<PipelineItem(int64_t)> generate = [&](int64_t index)
+        {
+            PipelineItem item;
+            item.index = index;
+            item.entry.m1 = jobs[index].m1_generator();
+            item.entry.m2 = jobs[index].m2_generator();
+            return item;
+        };
+
+        std::function<PipelineItem(PipelineItem &)> multiply = [&](PipelineItem &item)
+        {
+            const EntryJob &job = jobs[item.index];
+            complete_entry(item.entry, job.m1_rows, job.m1_cols_and_m2_rows, job.m2_cols, entry_product_threads);
+            return std::move(item);
+        };
+
+        // Only the record outlives the writer, the matrices are freed with the item
+        std::function<void(PipelineItem &)> write = [&](PipelineItem &item)
+        {
+            const EntryJob &job = jobs[item.index];
+            records[item.index] = save_entry(path, item.entry, job.seed, job.stream);
+            item.entry = DataSetEntry();
+        };
+
+        // An exception of any stage is rethrown here, after the GIL is taken back, and reaches Python
+        statistics = run_pipeline<PipelineItem, PipelineItem>(jobs.size(), generate_workers, multiply_workers, write_workers, queue_capacity,
+                                                               generate, multiply, write);
+    }
+
+    boost::python::list entries;
+    for (const auto &record : records)
+    {
+        entries.append(entry_tuple(record));
+    }
+
+    boost::python::dict stages;
+    auto add_stage = [&](const char *name, const StageStatistics &stage)
+    {
+        boost::python::dict values;
+        values["threads"] = stage.threads;
+        values["busy_seconds"] = stage.busy_seconds;
+        values["starved_seconds"] = stage.starved_seconds;
+        values["blocked_seconds"] = stage.blocked_seconds;
+        values["utilization"] = stage.utilization(statistics.wall_seconds);
+        stages[name] = values;
+    };
+    add_stage("generate", statistics.produce);
+    add_stage("multiply", statistics.transform);
+    add_stage("write", statistics.consume);
+    stages["wall_seconds"] = statistics.wall_seconds;
+
+    return boost::python::make_tuple(entries, stages);
+}
+
+boost::python::tuple generate_entries_rectangle_matrices(std::string path, boost::python::list parameters,
+                                    int generate_workers, int multiply_workers, int write_workers, int queue_capacity)
+{
+    std::vector<EntryJob> jobs;
+    if (!entry_jobs_from_parameters(parameters, false, jobs))
+    {
+        return boost::python::make_tuple(boost::python::list(), boost::python::dict());
+    }
+    return generate_entries(path, jobs, generate_workers, multiply_workers, write_workers, queue_capacity);
+}
+
+boost::python::tuple generate_entries_square_matrices(std::string path, boost::python::list parameters,
+                                    int generate_workers, int multiply_workers, int write_workers, int queue_capacity)
+{
+    std::vector<EntryJob> jobs;
+    if (!entry_jobs_from_parameters(parameters, true, jobs))
+    {
+        return boost::python::make_tuple(boost::python::list(), boost::python::dict());
+    }
+    return generate_entries(path, jobs, generate_workers, multiply_workers, write_workers, queue_capacity);
+}
+
+// A bytearray holding a copy of count values, which torch.frombuffer can wrap without a per-element object
+static boost::python::object int64_bytearray(const int64_t *values, int64_t count)
+{
+    const Py_ssize_t size = static_cast<Py_ssize_t>(count * sizeof(int64_t));
+    boost::python::object bytes(boost::python::handle<>(PyByteArray_FromStringAndSize(nullptr, size)));
+    std::memcpy(PyByteArray_AS_STRING(bytes.ptr()), values, size);
+    return bytes;
+}
+
+boost::python::tuple read_matrix_market_indices(std::string path, int num_threads)
+{
+    MatrixMarketIndices indices;
+    bool read;
+    {
+        ReleasedGil released;
+        read = read_matrix_market(path, indices, num_threads);
+    }
+    if (!read)
+    {
+        return boost::python::tuple();
+    }
+    return boost::python::make_tuple(indices.rows, indices.cols,
+                                     int64_bytearray(indices.row_indices.data(), indices.row_indices.size()),
+                                     int64_bytearray(indices.col_indices.data(), indices.col_indices.size()));
+}
+
+// The same tuple for a mapped CSC matrix: its rows as stored, and the column of every nonzero
+static boost::python::tuple matrix_indices(const Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> &matrix)
+{
+    std::vector<int64_t> col_indices(matrix.nonZeros());
+    for (int64_t j = 0; j < matrix.cols(); j++)
+    {
+        std::fill(col_indices.begin() + matrix.outerIndexPtr()[j], col_indices.begin() + matrix.outerIndexPtr()[j + 1], j);
+    }
+    return boost::python::make_tuple(matrix.rows(), matrix.cols(),
+                                     int64_bytearray(matrix.innerIndexPtr(), matrix.nonZeros()),
+                                     int64_bytearray(col_indices.data(), col_indices.size()));
+}
+
+// The last shard read from, kept mapped while its file keeps the same size and modification time
+static ShardReader shard_reader;
+static std::filesystem::path shard_reader_path;
+static std::filesystem::file_time_type shard_reader_time;
+static uintmax_t shard_reader_size = 0;
+
+// Reads matrix which of entry id of the shard, or () when the shard or the matrix is missing or malformed
+static boost::python::tuple read_shard_matrix_indices(const std::filesystem::path &path, int64_t id, ShardMatrix which)
+{
+    std::error_code error;
+    const auto time = std::filesystem::last_write_time(path, error);
+    const uintmax_t size = error ? 0 : std::filesystem::file_size(path, error);
+    if (error)
+    {
+        std::cerr << "Failed to open shard " << path << std::endl;
+        return boost::python::tuple();
+    }
+    if (path != shard_reader_path || time != shard_reader_time || size != shard_reader_size)
+    {
+        shard_reader_path.clear();
+        if (!shard_reader.open(path))
+        {
+            return boost::python::tuple();
+        }
+        shard_reader_path = path;
+        shard_reader_time = time;
+        shard_reader_size = size;
+    }
+
+    const char *record = shard_reader.record(id, which);
+    if (record == nullptr)
+    {
+        std::cerr << "Shard " << path << " has no well-formed entry " << id << std::endl;
+        return boost::python::tuple();
+    }
+    return matrix_indices(binary_matrix_map(record));
+}
+
+// Splits a shard entry address, <shard>#<id>:<m1|m2|product> with a decimal id, into its parts. Paths
+// without that exact suffix, such as files under a directory named run#3, are no address.
+static bool parse_shard_address(const std::string &path, std::string &shard_path, int64_t &id, ShardMatrix &which)
+{
+    const size_t colon = path.rfind(':');
+    if (colon == std::string::npos || colon == 0)
+    {
+        return false;
+    }
+    const size_t hash = path.rfind('#', colon - 1);
+    if (hash == std::string::npos || hash + 1 == colon)
+    {
+        return false;
+    }
+
+    const std::string name = path.substr(colon + 1);
+    if (name == "m1")
+    {
+        which = ShardMatrix::M1;
+    }
+    else if (name == "m2")
+    {
+        which = ShardMatrix::M2;
+    }
+    else if (name == "product")
+    {
+        which = ShardMatrix::Product;
+    }
+    else
+    {
+        return false;
+    }
+
+    if (!std::all_of(path.begin() + hash + 1, path.begin() + colon, [](char c) { return c >= '0' && c <= '9'; }))
+    {
+        return false;
+    }
+    auto parsed = std::from_chars(path.data() + hash + 1, path.data() + colon, id);
+    if (parsed.ec != std::errc())
+    {
+        return false;
+    }
+    shard_path = path.substr(0, hash);
+    return true;
 }
 
-boost::python::tuple generate_entry_horizontal_vertical_product(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m2_nnz_sparsity)
+boost::python::tuple read_binary_matrix_indices(std::string path)
 {
+    std::string shard_path;
+    int64_t id;
+    ShardMatrix which;
+    if (parse_shard_address(path, shard_path, id, which))
+    {
+        return read_shard_matrix_indices(shard_path, id, which);
+    }
+
+    MappedMatrix mapped;
+    if (!mapped.open(path))
+    {
+        return boost::python::tuple();
+    }
+    return matrix_indices(mapped.matrix());
+}
+
+boost::python::tuple generate_entry_horizontal_vertical_product(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed, uint64_t stream)
+{
+    seed = resolve_seed(seed);
+
     auto m1_generator = [=]() { 
-        return generate_matrix(size, size, max_nnz, m1_nnz_sparsity, 0.0, 1.0, 0.0, false);
+        return generate_matrix_threaded(size, size, max_nnz, m1_nnz_sparsity, 0.0, 1.0, 0.0, false, seed, sub_stream(stream, 0));
     };
 
     auto m2_generator = [=]() {
-        return generate_matrix_one_col(size, size, m2_nnz_sparsity);
+        return generate_matrix_one_col(size, size, m2_nnz_sparsity, seed, sub_stream(stream, 1));
     };
 
-    return generate_entry(path, size, size, size, m1_generator, m2_generator);
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
 }
 
-boost::python::tuple generate_entry_inner_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity)
+boost::python::tuple generate_entry_inner_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed, uint64_t stream)
 {
+    seed = resolve_seed(seed);
+
     auto m1_generator = [=]() { 
-        return generate_matrix_one_row(size, size, m1_nnz_sparsity);
+        return generate_matrix_one_row(size, size, m1_nnz_sparsity, seed, sub_stream(stream, 0));
     };
 
     auto m2_generator = [=]() {
-        return generate_matrix_one_col(size, size, m2_nnz_sparsity);
+        return generate_matrix_one_col(size, size, m2_nnz_sparsity, seed, sub_stream(stream, 1));
     };
 
-    return generate_entry(path, size, size, size, m1_generator, m2_generator);
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
 } 
 
-boost::python::tuple generate_entry_outer_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity)
+boost::python::tuple generate_entry_outer_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed, uint64_t stream)
 {
+    seed = resolve_seed(seed);
+
     auto m1_generator = [=]() { 
-        return generate_matrix_one_col(size, size, m1_nnz_sparsity);
+        return generate_matrix_one_col(size, size, m1_nnz_sparsity, seed, sub_stream(stream, 0));
     };
 
     auto m2_generator = [=]() {
-        return generate_matrix_one_row(size, size, m2_nnz_sparsity);
+        return generate_matrix_one_row(size, size, m2_nnz_sparsity, seed, sub_stream(stream, 1));
     };
 
-    return generate_entry(path, size, size, size, m1_generator, m2_generator);
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
 }
 
-boost::python::tuple generate_entry_extreme_cases(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m1_row_col_sparsity, float m2_nnz_sparsity, float m2_row_col_sparsity)
-{   
-    auto gen1 = [=]() { 
-        return generate_matrix_multiple_cols(size, size, max_nnz, m1_nnz_sparsity, m1_row_col_sparsity);
+boost::python::tuple generate_entry_extreme_cases(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m1_row_col_sparsity, float m2_nnz_sparsity, float m2_row_col_sparsity, uint64_t seed, uint64_t stream)
+{
+    seed = resolve_seed(seed);
+
+    auto gen1 = [=](uint64_t matrix_stream) { 
+        return generate_matrix_multiple_cols(size, size, max_nnz, m1_nnz_sparsity, m1_row_col_sparsity, seed, matrix_stream);
     };
 
-    auto gen2 = [=]() {
-        return generate_matrix_multiple_rows(size, size, max_nnz, m2_nnz_sparsity, m2_row_col_sparsity);
+    auto gen2 = [=](uint64_t matrix_stream) {
+        return generate_matrix_multiple_rows_threaded(size, size, max_nnz, m2_nnz_sparsity, m2_row_col_sparsity, seed, matrix_stream);
     };
 
-    std::array<std::function<Eigen::SparseMatrix<bool, 0, int64_t>()>, 2> generators = {gen1, gen2};
+    std::array<std::function<Eigen::SparseMatrix<bool, 0, int64_t>(uint64_t)>, 2> generators = {gen1, gen2};
 
     // Random number generation setup
-    std::random_device rd;
-    std::mt19937 gen(rd());
+    RandomEngine gen(seed, sub_stream(stream, 2));
     std::uniform_int_distribution<> dis(0, 1);
 
-    // Randomly select the generators
-    auto m1_generator = generators[dis(gen)];
-    auto m2_generator = generators[dis(gen)];
+    // Randomly select the generators, each matrix keeps its own stream even when both pick the same one
+    auto m1_select = generators[dis(gen)];
+    auto m2_select = generators[dis(gen)];
+    auto m1_generator = [=]() { return m1_select(sub_stream(stream, 0)); };
+    auto m2_generator = [=]() { return m2_select(sub_stream(stream, 1)); };
+
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
+}
+
+boost::python::tuple generate_entry_rmat(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t m1_cells, int64_t m2_cells,
+                                    float a, float b, float c, uint64_t seed, uint64_t stream)
+{
+    seed = resolve_seed(seed);
+
+    // R-MAT has no serial variant, generator threads only set how many threads it runs on
+    auto m1_generator = [=]() {
+        return generate_matrix_rmat(m1_rows, m1_cols_and_m2_rows, m1_cells, a, b, c, seed, sub_stream(stream, 0), generator_threads);
+    };
+
+    auto m2_generator = [=]() {
+        return generate_matrix_rmat(m1_cols_and_m2_rows, m2_cols, m2_cells, a, b, c, seed, sub_stream(stream, 1), generator_threads);
+    };
+
+    return generate_entry(path, m1_rows, m1_cols_and_m2_rows, m2_cols, m1_generator, m2_generator, seed, stream);
+}
+
+boost::python::tuple generate_entry_banded(std::string path, int64_t size, int64_t bandwidth, float m1_fill, float m2_fill, uint64_t seed, uint64_t stream)
+{
+    seed = resolve_seed(seed);
+
+    auto m1_generator = [=]() {
+        return generate_matrix_banded(size, size, bandwidth, m1_fill, seed, sub_stream(stream, 0), generator_threads);
+    };
+
+    auto m2_generator = [=]() {
+        return generate_matrix_banded(size, size, bandwidth, m2_fill, seed, sub_stream(stream, 1), generator_threads);
+    };
+
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
+}
+
+boost::python::tuple generate_entry_block_diagonal(std::string path, int64_t size, int64_t block_size, float m1_fill, float m2_fill, uint64_t seed, uint64_t stream)
+{
+    seed = resolve_seed(seed);
+
+    auto m1_generator = [=]() {
+        return generate_matrix_block_diagonal(size, size, block_size, m1_fill, seed, sub_stream(stream, 0), generator_threads);
+    };
+
+    auto m2_generator = [=]() {
+        return generate_matrix_block_diagonal(size, size, block_size, m2_fill, seed, sub_stream(stream, 1), generator_threads);
+    };
+
+    return generate_entry(path, size, size, size, m1_generator, m2_generator, seed, stream);
+}
+
+boost::python::tuple generate_entry_stencil(std::string path, int64_t nx, int64_t ny, int64_t nz, int points)
+{
+    const int64_t size = nx * ny * nz;
+    auto generator = [=]() { return generate_matrix_stencil(nx, ny, nz, points, generator_threads); };
 
-    return generate_entry(path, size, size, size, m1_generator, m2_generator);
+    return generate_entry(path, size, size, size, generator, generator, 0, 0);
 }
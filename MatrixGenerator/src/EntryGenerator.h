@@ -7,28 +7,98 @@
 
 #include "MatrixGenerator.h"
 
+// When enabled, the product is only counted (symbolic SpGEMM) and never materialized or saved.
+void set_symbolic_product(bool enabled);
+
+// Selects the SpGEMM kernel by name ("eigen", "gustavson", "bitmap", "hash", "esc", "bitmatrix", "auto"),
+// returns false for unknown names. "auto" (the default) picks a kernel per product from its structure.
+bool set_product_kernel(std::string name);
+
+// Threads used by the product step, 1 (the default) runs it serially and 0 uses every hardware thread.
+void set_product_threads(int num_threads);
+
+// Threads used to generate each matrix. 1 (the default) runs the serial generators, anything else the
+// column-block parallel ones, with 0 using every hardware thread.
+void set_generator_threads(int num_threads);
+
+// Logs which kernel "auto" picked for every product and why.
+void set_product_log(bool enabled);
+
+// Selects how entry matrices are saved: "mtx" (the default) for MatrixMarket pattern files, "binary" for
+// mappable CSC files with a .csc extension. Returns false for unknown names.
+bool set_matrix_format(std::string name);
+
+// Appends every following entry to the shard at path (created or truncated) instead of saving separate
+// files; the reported paths become <shard>#<id>:m1, :m2 and :product. An empty path closes the shard and
+// writes its index. Returns false on failure.
+bool set_shard(std::string path);
+
 DataSetEntry generate_entry_helper(int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, 
                                     const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m1_matrix_generator,
                                     const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator);
 
+// Saves the entry and returns its description, ending with the (seed, stream) pair that regenerates it.
+// Outside a shard its matrices go to <seed>_<stream>_m1, _m2 and _product under path.
 boost::python::tuple generate_entry(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols,
                                     const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m1_matrix_generator,
-                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator);
+                                    const std::function<Eigen::SparseMatrix<bool, 0, int64_t>()> &m2_matrix_generator,
+                                    uint64_t seed, uint64_t stream);
+
+// The entry generators below take an optional seed (0 draws a fresh one) and stream; matrix 1, matrix 2
+// and any other choices of an entry use sub-streams of stream, so (seed, index) identifies an entry.
 
 boost::python::tuple generate_entry_rectangle_matrices(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t max_nnz, 
                                     float m1_nnz_sparsity, float m1_row_sparsity, float m1_col_sparsity, float m1_diag_sparsity, bool m1_symmetric,
-                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric);
+                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric,
+                                    uint64_t seed = 0, uint64_t stream = 0);
 
 boost::python::tuple generate_entry_square_matrices(std::string path, int64_t size, int64_t max_nnz,
                                     float m1_nnz_sparsity, float m1_row_sparsity, float m1_col_sparsity, float m1_diag_sparsity, bool m1_symmetric,
-                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric);
+                                    float m2_nnz_sparsity, float m2_row_sparsity, float m2_col_sparsity, float m2_diag_sparsity, bool m2_symmetric,
+                                    uint64_t seed = 0, uint64_t stream = 0);
+
+// Pipelined batches: generator workers feed multiply workers, which feed writer threads, through queues
+// of queue_capacity entries that hold back the faster stages and cap the entries held in memory (at most
+// the workers plus twice the capacity). Each item of parameters is a tuple of the arguments the single entry
+// function takes after path, seed and stream included. Returns (entries in parameter order, stages), where
+// stages maps "generate", "multiply" and "write" to their thread count, busy, starved and blocked seconds
+// and utilization, and "wall_seconds" to the run time. Worker counts of 0 use every hardware thread; the
+// multiply workers split the product threads between them. A non-positive queue_capacity returns empty
+// results, and an exception of any stage stops the batch and is raised once its threads have joined.
+boost::python::tuple generate_entries_rectangle_matrices(std::string path, boost::python::list parameters,
+                                    int generate_workers = 1, int multiply_workers = 1, int write_workers = 1, int queue_capacity = 4);
+
+boost::python::tuple generate_entries_square_matrices(std::string path, boost::python::list parameters,
+                                    int generate_workers = 1, int multiply_workers = 1, int write_workers = 1, int queue_capacity = 4);
+
+// Reads a MatrixMarket coordinate file on num_threads threads (0 for all) and returns (rows, cols,
+// row indices, col indices), the indices 0-based native int64 values in bytearrays, or () on failure
+boost::python::tuple read_matrix_market_indices(std::string path, int num_threads = 0);
+
+// Reads a binary CSC file written in the "binary" matrix format, or a matrix of a shard entry addressed as
+// <shard>#<id>:<m1|m2|product>, after checking its whole structure. Returns the same tuple as
+// read_matrix_market_indices, or () on failure. The last shard stays mapped while its file is unchanged.
+boost::python::tuple read_binary_matrix_indices(std::string path);
+
+boost::python::tuple generate_entry_horizontal_vertical_product(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+boost::python::tuple generate_entry_inner_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+boost::python::tuple generate_entry_outer_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+boost::python::tuple generate_entry_extreme_cases(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m1_row_col_sparsity, float m2_nnz_sparsity, float m2_row_col_sparsity, uint64_t seed = 0, uint64_t stream = 0);
 
-boost::python::tuple generate_entry_horizontal_vertical_product(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m2_nnz_sparsity);
+// Power-law entry: R-MAT matrices of m1_cells and m2_cells draws with quadrant probabilities a, b, c
+boost::python::tuple generate_entry_rmat(std::string path, int64_t m1_rows, int64_t m1_cols_and_m2_rows, int64_t m2_cols, int64_t m1_cells, int64_t m2_cells,
+                                    float a, float b, float c, uint64_t seed = 0, uint64_t stream = 0);
 
-boost::python::tuple generate_entry_inner_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity);
+// Structured entries of size x size matrices: both banded with the same bandwidth, or both block diagonal
+// with the same block size, each with its own fill
+boost::python::tuple generate_entry_banded(std::string path, int64_t size, int64_t bandwidth, float m1_fill, float m2_fill, uint64_t seed = 0, uint64_t stream = 0);
 
-boost::python::tuple generate_entry_outer_product(std::string path, int64_t size, float m1_nnz_sparsity, float m2_nnz_sparsity);
+boost::python::tuple generate_entry_block_diagonal(std::string path, int64_t size, int64_t block_size, float m1_fill, float m2_fill, uint64_t seed = 0, uint64_t stream = 0);
 
-boost::python::tuple generate_entry_extreme_cases(std::string path, int64_t size, int64_t max_nnz, float m1_nnz_sparsity, float m1_row_col_sparsity, float m2_nnz_sparsity, float m2_row_col_sparsity);
+// Square of the stencil matrix of an nx x ny x nz grid; the pattern is fixed, so seed and stream are 0
+boost::python::tuple generate_entry_stencil(std::string path, int64_t nx, int64_t ny, int64_t nz, int points);
 
 #endif // ENTRY_GENERATOR_H
@@ -1,286 +1,1345 @@
 #include "MatrixGenerator.h"
+#include "Bitset.h"
+#include "Parallel.h"
+#include "Random.h"
+#include "Utilities.h"
+#include <array>
+#include <atomic>
 #include <unordered_set>
 #include <vector>
 #include <algorithm>
+#include <numeric>
 #include <chrono>
 #include <iostream>
 #include <sstream>
 #include <fstream>
 #include <filesystem>
+#include <memory>
 
 using namespace Eigen;
 
-std::function<int64_t(std::default_random_engine &)> select_random_generator(std::default_random_engine &gen, int64_t min_val, int64_t max_val, std::string debug_name)
+RandomGenerator select_random_generator(RandomEngine &gen, int64_t min_val, int64_t max_val, [[maybe_unused]] std::string debug_name)
 {
-    std::uniform_int_distribution<int> dist_type(0, 2);
-
-    switch (dist_type(gen))
+    switch (uniform_below(gen, 3))
     {
     case 0:
+        return UniformGenerator{min_val, max_val};
+    case 1:
+        return NormalGenerator(min_val, max_val);
+    default:
+        return GeometricGenerator(min_val, max_val);
+    }
+}
+
+// Floyd's algorithm: marks count distinct values of [0, range) in bits (sized to range) and returns them.
+// draw(gen, j) supplies a candidate in [0, j], which lets callers shape the selection with any distribution;
+// a taken candidate is replaced by j, so exactly count draws are made.
+template <typename Draw>
+static std::vector<int64_t> sample_distinct(RandomEngine &gen, int64_t range, int64_t count, std::vector<uint64_t> &bits, Draw &&draw)
+{
+    count = std::max(int64_t(0), std::min(count, range));
+    bits.assign(bitset_words(range), 0);
+
+    std::vector<int64_t> values;
+    values.reserve(count);
+    for (int64_t j = range - count; j < range; j++)
     {
-        std::uniform_int_distribution<int64_t> dist(min_val, max_val);
-        return [dist](std::default_random_engine &gen) mutable
-        { return dist(gen); };
+        int64_t t = draw(gen, j);
+        if (bitset_test(bits.data(), t))
+        {
+            t = j;
+        }
+        bitset_set(bits.data(), t);
+        values.push_back(t);
     }
-    case 1:
+    return values;
+}
+
+// Rescales draws of a generator from [min_val, min_val + range) onto [0, j], keeping its shape. The
+// generator is a concrete distribution type and fills a batch of draws at a time.
+template <typename Generator>
+class ScaledDraw
+{
+public:
+    ScaledDraw(Generator &generator, int64_t min_val, int64_t range)
+        : generator(generator), min_val(min_val), range(range)
     {
-        double mean = (max_val + min_val) / 2;
-        double stddev = (max_val - min_val) / 4;
-        std::normal_distribution<double> dist(mean, stddev);
-        return [dist, min_val, max_val](std::default_random_engine &gen) mutable
+    }
+
+    int64_t operator()(RandomEngine &gen, int64_t j)
+    {
+        if (next == batch_size)
         {
-            return std::max(min_val, std::min(max_val, static_cast<int64_t>(dist(gen))));
-        };
+            generator.fill(gen, batch, batch_size);
+            next = 0;
+        }
+        return (batch[next++] - min_val) * (j + 1) / range;
     }
-    case 2:
+
+private:
+    static constexpr int64_t batch_size = 64;
+
+    Generator &generator;
+    int64_t min_val, range;
+    int64_t batch[batch_size];
+    int64_t next = batch_size;
+};
+
+// Partial Fisher-Yates: moves a uniform random subset of count items to the front and drops the rest
+template <typename T>
+static void partial_shuffle(std::vector<T> &items, int64_t count, RandomEngine &gen)
+{
+    count = std::min(count, static_cast<int64_t>(items.size()));
+    for (int64_t i = 0; i < count; i++)
     {
-        double desired_coverage = 0.95;
-        double p = 1 - std::pow(1.0 - desired_coverage, 1.0 / (max_val - min_val + 1));
+        std::swap(items[i], items[i + uniform_below(gen, items.size() - i)]);
+    }
+    items.resize(count);
+}
+
+static int64_t uniform_draw(RandomEngine &gen, int64_t j)
+{
+    return uniform_below(gen, j + 1);
+}
 
-        std::geometric_distribution<int64_t> dist(p);
-        return [dist, min_val, max_val](std::default_random_engine &gen) mutable
+// Visits every position of [0, count) independently with probability p, in ascending order. Geometric
+// draws jump over the gaps between hits, or between misses when p is above one half, so the random draws
+// follow the rarer outcome rather than count.
+template <typename Visit>
+static void bernoulli_positions(RandomEngine &gen, int64_t count, double p, Visit &&visit)
+{
+    if (p <= 0.0)
+    {
+        return;
+    }
+    if (p >= 1.0)
+    {
+        for (int64_t i = 0; i < count; i++)
         {
-            return std::max(min_val, std::min(max_val, static_cast<int64_t>(dist(gen))));
-        };
+            visit(i);
+        }
+        return;
     }
+
+    if (p > 0.5)
+    {
+        // Dense draws jump over the misses instead, so the logarithms follow the misses
+        GeometricGaps gap(1.0 - p, count);
+        int64_t i = 0;
+        for (double miss = gap(gen); i < count; miss += 1 + gap(gen))
+        {
+            const int64_t end = static_cast<int64_t>(std::min<double>(miss, count));
+            for (; i < end; i++)
+            {
+                visit(i);
+            }
+            i = end + 1;
+        }
+        return;
     }
 
-    std::cerr << "Invalid distribution type selected." << std::endl;
-    return nullptr;
+    GeometricGaps gap(p, count);
+    for (double i = gap(gen); i < count; i += 1 + gap(gen))
+    {
+        visit(static_cast<int64_t>(i));
+    }
 }
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_helper(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, int recursion_count)
+// Visits count distinct uniform positions of [0, space) in any order: Floyd's algorithm over a bitset
+// when the space is small next to count, over a hash set otherwise
+template <typename Visit>
+static void uniform_positions(RandomEngine &gen, int64_t space, int64_t count, Visit &&visit)
 {
-    std::random_device rd;
-    std::default_random_engine gen(rd());
+    count = std::max(int64_t(0), std::min(count, space));
+    if (space <= 64 * count)
+    {
+        std::vector<uint64_t> bits;
+        for (int64_t position : sample_distinct(gen, space, count, bits, uniform_draw))
+        {
+            visit(position);
+        }
+        return;
+    }
 
+    std::unordered_set<int64_t> taken;
+    taken.reserve(count);
+    for (int64_t j = space - count; j < space; j++)
+    {
+        int64_t position = uniform_draw(gen, j);
+        if (!taken.insert(position).second)
+        {
+            position = j;
+            taken.insert(position);
+        }
+        visit(position);
+    }
+}
+
+// Visits the hits of independent Bernoulli(p) draws over [0, space), cut down to a uniform subset of
+// max_nnz when more come up, in any order. When the expected hits stay within twice max_nnz they are
+// drawn with geometric skips and truncated. Beyond that only their count is drawn and min(count, max_nnz)
+// uniform positions are sampled directly, the same distribution without materializing the discarded hits.
+template <typename Visit>
+static void bernoulli_subset(RandomEngine &gen, int64_t space, double p, int64_t max_nnz, Visit &&visit)
+{
+    max_nnz = std::max(int64_t(0), max_nnz);
+    p = std::max(0.0, std::min(1.0, p));
+
+    if (p * space <= 2.0 * max_nnz)
+    {
+        std::vector<int64_t> hits;
+        bernoulli_positions(gen, space, p, [&](int64_t position) { hits.push_back(position); });
+        if (static_cast<int64_t>(hits.size()) > max_nnz)
+        {
+            partial_shuffle(hits, max_nnz, gen);
+        }
+        for (int64_t position : hits)
+        {
+            visit(position);
+        }
+        return;
+    }
+
+    int64_t count = std::min(max_nnz, std::binomial_distribution<int64_t>(space, p)(gen));
+    uniform_positions(gen, space, count, visit);
+}
+
+// Rows, cols and excluded diagonals chosen for one generate_matrix call. The exclusion generator draws
+// diagonals row - col, as it always has; each drawn diagonal is stored by its d = col - row at bit
+// d + rows - 1 of excluded_diags_bits, and drawn values that are no diagonal of the matrix exclude nothing.
+struct MatrixSelection
+{
+    std::vector<int64_t> rows, cols;
+    std::vector<uint64_t> rows_bits, cols_bits, excluded_diags_bits;
+    int64_t diag_offset;
+
+    bool diag_excluded(int64_t row, int64_t col) const
+    {
+        return bitset_test(excluded_diags_bits.data(), col - row + diag_offset);
+    }
+};
+
+static MatrixSelection select_rows_cols_diags(RandomEngine &gen, int64_t rows, int64_t cols, float row_sparsity, float col_sparsity, float diag_sparsity)
+{
     auto rows_gen = select_random_generator(gen, 0, rows - 1, "row_gen");
     auto cols_gen = select_random_generator(gen, 0, cols - 1, "col_gen");
     auto excluded_diags_gen = select_random_generator(gen, -rows + 1, cols - 1, "excluded_diags_gen");
 
-    std::unordered_set<int64_t> selected_rows_set;
+    MatrixSelection selection;
+    selection.diag_offset = rows - 1;
+
     int64_t target_rows_count = std::round(rows * (1.0 - row_sparsity));
     target_rows_count = std::max(target_rows_count, 1l);
-    for (int64_t i = 0; i < target_rows_count * 100; i++)
+    std::visit([&](auto &generator)
     {
-        if (selected_rows_set.size() >= target_rows_count)
-        {
-            break;
-        }
-        selected_rows_set.insert(rows_gen(gen));
-    }
-    std::vector<int64_t> selected_rows(selected_rows_set.begin(), selected_rows_set.end());
+        selection.rows = sample_distinct(gen, rows, target_rows_count, selection.rows_bits, ScaledDraw(generator, 0, rows));
+    }, rows_gen);
 
-    std::unordered_set<int64_t> selected_cols_set;
     int64_t target_cols_count = std::round(cols * (1.0 - col_sparsity));
     target_cols_count = std::max(target_cols_count, 1l);
-    for (int64_t i = 0; i < target_cols_count * 100; i++)
+    std::visit([&](auto &generator)
     {
-        if (selected_cols_set.size() >= target_cols_count)
+        selection.cols = sample_distinct(gen, cols, target_cols_count, selection.cols_bits, ScaledDraw(generator, 0, cols));
+    }, cols_gen);
+
+    int64_t target_diags_exclude_count = std::round((rows + cols - 1) * diag_sparsity);
+    target_diags_exclude_count = std::min(target_diags_exclude_count, rows + cols - 2);
+    std::vector<int64_t> drawn_diags;
+    std::vector<uint64_t> drawn_diags_bits;
+    std::visit([&](auto &generator)
+    {
+        drawn_diags = sample_distinct(gen, rows + cols - 1, target_diags_exclude_count, drawn_diags_bits, ScaledDraw(generator, -rows + 1, rows + cols - 1));
+    }, excluded_diags_gen);
+
+    // Position i is row - col = i - (rows - 1), so col - row lands at bit 2 * (rows - 1) - i
+    selection.excluded_diags_bits.assign(bitset_words(rows + cols - 1), 0);
+    for (int64_t i : drawn_diags)
+    {
+        const int64_t bit = 2 * (rows - 1) - i;
+        if (bit >= 0 && bit < rows + cols - 1)
         {
-            break;
+            bitset_set(selection.excluded_diags_bits.data(), bit);
         }
-        selected_cols_set.insert(cols_gen(gen));
     }
-    std::vector<int64_t> selected_cols(selected_cols_set.begin(), selected_cols_set.end());
 
-    std::unordered_set<int64_t> excluded_diags;
-    int64_t target_diags_exclude_count = std::round((rows + cols - 1) * diag_sparsity);
-    target_diags_exclude_count = std::min(target_diags_exclude_count, rows + cols - 2);
+    return selection;
+}
+
+// Columns per block of the parallel generators. Blocks, not threads, own the random substreams, so a
+// parallel result depends on (seed, stream) only and not on the thread count.
+static constexpr int64_t generator_block_cols = 256;
+
+// How many of draws items taken without replacement from total items fall among the first successes,
+// simulated over the shorter of the taken and the left-over sides
+static int64_t hypergeometric(RandomEngine &gen, int64_t draws, int64_t successes, int64_t total)
+{
+    if (draws * 2 > total)
+    {
+        return successes - hypergeometric(gen, total - draws, successes, total);
+    }
 
-    for (int64_t i = 0; i < target_diags_exclude_count * 100; i++)
+    int64_t hits = 0;
+    for (int64_t i = 0; i < draws; i++)
     {
-        if (excluded_diags.size() >= target_diags_exclude_count)
+        int64_t remaining = total - i;
+        int64_t remaining_successes = successes - hits;
+        if (remaining_successes == 0)
+        {
+            break;
+        }
+        if (remaining_successes == remaining)
         {
+            hits += draws - i;
             break;
         }
-        excluded_diags.insert(excluded_diags_gen(gen));
+        hits += static_cast<int64_t>(uniform_below(gen, remaining)) < remaining_successes;
+    }
+    return hits;
+}
+
+// Splits k distinct items drawn from slots [begin, end), slot i holding prefix[i + 1] - prefix[i] items,
+// into per-slot counts: a multivariate hypergeometric draw built from pairwise splits
+static void hypergeometric_split(RandomEngine &gen, const int64_t *prefix, int64_t begin, int64_t end, int64_t k, int64_t *counts)
+{
+    if (k == 0 || end - begin == 1)
+    {
+        std::fill(counts + begin, counts + end, 0);
+        counts[begin] = k;
+        return;
     }
 
-    std::vector<std::pair<int64_t, int64_t>> all_elements;
+    int64_t mid = begin + (end - begin) / 2;
+    int64_t left = prefix[mid] - prefix[begin];
+    int64_t left_k = hypergeometric(gen, k, left, prefix[end] - prefix[begin]);
+    hypergeometric_split(gen, prefix, begin, mid, left_k, counts);
+    hypergeometric_split(gen, prefix, mid, end, k - left_k, counts);
+}
 
-    for (int64_t row = 0; row < rows; row++)
+// Bits of b starting at bit pos; b must hold a word past the last one read
+static uint64_t bits_at(const uint64_t *b, int64_t pos)
+{
+    int64_t word = pos >> 6, offset = pos & 63;
+    return offset ? (b[word] >> offset) | (b[word + 1] << (64 - offset)) : b[word];
+}
+
+// The eligible cells of generate_matrix, column by column. Column j holds the cells (r, j) with r a
+// selected row (r >= j when symmetric) and j a selected col, and in the symmetric case also the mirrors
+// (c, j) of the cells (j, c) with c < j, j a selected row and c a selected col. The diagonal of the
+// unmirrored cell must not be excluded. This is the item space the serial generator samples from.
+struct EligibleColumns
+{
+    EligibleColumns(int64_t rows, int64_t cols, bool symmetric, const MatrixSelection &selection)
+        : rows(rows), cols(cols), symmetric(symmetric), selection(selection),
+          sorted_rows(selection.rows), sorted_cols(selection.cols)
     {
-        for (int64_t col = 0; col < (symmetric ? std::min(row + 1, cols) : cols); col++)
+        std::sort(sorted_rows.begin(), sorted_rows.end());
+        std::sort(sorted_cols.begin(), sorted_cols.end());
+
+        // Both diagonal bitsets are padded so shifted word reads never run past them
+        const int64_t diags = rows + cols - 1;
+        const int64_t padded_words = bitset_words(diags) + bitset_words(std::max(rows, cols)) + 2;
+        excluded = selection.excluded_diags_bits;
+        excluded.resize(padded_words, 0);
+        reversed_excluded.assign(padded_words, 0);
+        for (int64_t d = 0; d < diags; d++)
         {
-            if (excluded_diags.find(row - col) != excluded_diags.end())
+            if (bitset_test(excluded.data(), d))
             {
-                continue;
+                bitset_set(reversed_excluded.data(), diags - 1 - d);
+                excluded_diags.push_back(d);
             }
+            else
+            {
+                kept_diags.push_back(d);
+            }
+        }
+    }
 
-            if (selected_rows_set.find(row) == selected_rows_set.end() || selected_cols_set.find(col) == selected_cols_set.end())
+    // Number of eligible cells in column j
+    int64_t count(int64_t j) const
+    {
+        int64_t total = 0;
+        if (bitset_test(selection.cols_bits.data(), j))
+        {
+            // Rows r in [lo, rows) lie on diagonal j - r + rows - 1
+            total += count_kept(selection.rows_bits, sorted_rows, symmetric ? j : 0, rows, j + rows - 1, true);
+        }
+        if (symmetric && j < rows && bitset_test(selection.rows_bits.data(), j))
+        {
+            // Mirrored cols c in [0, j) lie on diagonal c - j + rows - 1
+            total += count_kept(selection.cols_bits, sorted_cols, 0, j, rows - 1 - j, false);
+        }
+        return total;
+    }
+
+    // Appends k distinct eligible rows of column j, which has count eligible cells, to out in ascending
+    // order. seen is a cleared bitset over rows and is left cleared; candidates is scratch.
+    void sample(int64_t j, int64_t k, int64_t count, RandomEngine &gen, std::vector<uint64_t> &seen, std::vector<int64_t> &candidates, std::vector<int64_t> &out) const
+    {
+        if (k == 0)
+        {
+            return;
+        }
+
+        // The lower part of the column followed by the mirrored one
+        Proposal parts[2];
+        int part_count = 0;
+        if (bitset_test(selection.cols_bits.data(), j))
+        {
+            parts[part_count++] = proposal(selection.rows_bits, sorted_rows, symmetric ? j : 0, rows, j + rows - 1, true);
+        }
+        if (symmetric && j < rows && bitset_test(selection.rows_bits.data(), j))
+        {
+            parts[part_count++] = proposal(selection.cols_bits, sorted_cols, 0, j, rows - 1 - j, false);
+        }
+
+        int64_t space = 0;
+        for (int p = 0; p < part_count; p++)
+        {
+            space += parts[p].size;
+        }
+
+        auto candidate = [&](int64_t u, int64_t &row)
+        {
+            int p = 0;
+            for (; u >= parts[p].size; p++)
             {
-                continue;
+                u -= parts[p].size;
             }
+            return parts[p].at(u, row);
+        };
 
-            all_elements.push_back({row, col});
-            if (symmetric && row != col && col < rows && row < cols)
+        size_t start = out.size();
+        if (k * 2 <= count)
+        {
+            // Rejection sampling: at most half the eligible cells are taken, so the expected number of
+            // draws stays within twice the proposal space of the column
+            while (static_cast<int64_t>(out.size() - start) < k)
+            {
+                int64_t row;
+                if (candidate(uniform_below(gen, space), row) && !bitset_test(seen.data(), row))
+                {
+                    bitset_set(seen.data(), row);
+                    out.push_back(row);
+                }
+            }
+            for (size_t i = start; i < out.size(); i++)
             {
-                all_elements.push_back({col, row});
+                seen[out[i] >> 6] = 0;
             }
         }
+        else
+        {
+            candidates.clear();
+            for (int64_t u = 0; u < space; u++)
+            {
+                int64_t row;
+                if (candidate(u, row))
+                {
+                    candidates.push_back(row);
+                }
+            }
+            partial_shuffle(candidates, k, gen);
+            out.insert(out.end(), candidates.begin(), candidates.end());
+        }
+        std::sort(out.begin() + start, out.end());
     }
 
-    if (all_elements.size() == 0)
+private:
+    // One part of a column's proposal space: either the selected positions x in range, accepted when their
+    // diagonal is kept, or the kept diagonals in range, accepted when their position is selected.
+    // Diagonal d and position x are related by d = base - x when reversed, else d = base + x.
+    struct Proposal
+    {
+        const int64_t *items;
+        int64_t size;
+        bool by_diagonal;
+        const uint64_t *bits, *excluded;
+        int64_t base;
+        bool reversed;
+
+        bool at(int64_t u, int64_t &x) const
+        {
+            if (by_diagonal)
+            {
+                x = reversed ? base - items[u] : items[u] - base;
+                return bitset_test(bits, x);
+            }
+            x = items[u];
+            return !bitset_test(excluded, reversed ? base - x : base + x);
+        }
+    };
+
+    // Proposal over x in [lo, hi) from the smaller of the two spaces
+    Proposal proposal(const std::vector<uint64_t> &bits, const std::vector<int64_t> &sorted, int64_t lo, int64_t hi, int64_t base, bool reversed) const
     {
-        if (recursion_count > 10)
+        Proposal part{nullptr, 0, false, bits.data(), excluded.data(), base, reversed};
+        if (lo >= hi)
         {
-            std::cerr << "Failed to generate matrix after 10 attempts." << std::endl;
-            return Eigen::SparseMatrix<bool, 0, int64_t>(rows, cols);
+            return part;
         }
-        return generate_matrix_helper(rows, cols, max_nnz, nnz_sparsity * 0.9, row_sparsity * 0.9, col_sparsity * 0.9, diag_sparsity * 0.9, symmetric, recursion_count + 1);
-    }
 
-    std::shuffle(all_elements.begin(), all_elements.end(), std::default_random_engine());
-    max_nnz = std::min(max_nnz, std::min(static_cast<int64_t>(all_elements.size()), static_cast<int64_t>(rows * cols * (1.0 - nnz_sparsity))));
-    all_elements.resize(max_nnz);
+        auto sorted_begin = std::lower_bound(sorted.begin(), sorted.end(), lo);
+        auto sorted_end = std::lower_bound(sorted_begin, sorted.end(), hi);
+        auto kept_begin = std::lower_bound(kept_diags.begin(), kept_diags.end(), reversed ? base - (hi - 1) : base + lo);
+        auto kept_end = std::upper_bound(kept_begin, kept_diags.end(), reversed ? base - lo : base + hi - 1);
 
-    std::sort(all_elements.begin(), all_elements.end(), [](const std::pair<int64_t, int64_t> &a, const std::pair<int64_t, int64_t> &b)
-              { return a.first < b.first || (a.first == b.first && a.second < b.second); });
+        if (kept_end - kept_begin < sorted_end - sorted_begin)
+        {
+            part.items = kept_diags.data() + (kept_begin - kept_diags.begin());
+            part.size = kept_end - kept_begin;
+            part.by_diagonal = true;
+        }
+        else
+        {
+            part.items = sorted.data() + (sorted_begin - sorted.begin());
+            part.size = sorted_end - sorted_begin;
+        }
+        return part;
+    }
 
-    std::vector<Eigen::Triplet<bool, int64_t>> triplets;
-    for (auto &pair : all_elements)
+    // Number of x in [lo, hi), set in bits, whose diagonal (base - x when reversed, else base + x) is kept.
+    // Scans the shorter of the kept and excluded diagonal lists over that range, or the bitsets word by
+    // word when both lists are long.
+    int64_t count_kept(const std::vector<uint64_t> &bits, const std::vector<int64_t> &sorted, int64_t lo, int64_t hi, int64_t base, bool reversed) const
     {
-        triplets.emplace_back(pair.first, pair.second, 1);
+        if (lo >= hi)
+        {
+            return 0;
+        }
+
+        const int64_t first = reversed ? base - (hi - 1) : base + lo;
+        const int64_t last = reversed ? base - lo : base + hi - 1;
+        auto kept_begin = std::lower_bound(kept_diags.begin(), kept_diags.end(), first);
+        auto kept_end = std::upper_bound(kept_begin, kept_diags.end(), last);
+        auto excluded_begin = std::lower_bound(excluded_diags.begin(), excluded_diags.end(), first);
+        auto excluded_end = std::upper_bound(excluded_begin, excluded_diags.end(), last);
+        const int64_t kept_count = kept_end - kept_begin;
+        const int64_t excluded_count = excluded_end - excluded_begin;
+        const int64_t words = (hi - lo) / 64 + 2;
+
+        auto x_of = [&](int64_t d)
+        {
+            return reversed ? base - d : d - base;
+        };
+
+        int64_t total = 0;
+        if (kept_count <= excluded_count && kept_count <= words)
+        {
+            for (auto d = kept_begin; d != kept_end; ++d)
+            {
+                total += bitset_test(bits.data(), x_of(*d));
+            }
+        }
+        else if (excluded_count <= words)
+        {
+            total = std::lower_bound(sorted.begin(), sorted.end(), hi) - std::lower_bound(sorted.begin(), sorted.end(), lo);
+            for (auto d = excluded_begin; d != excluded_end; ++d)
+            {
+                total -= bitset_test(bits.data(), x_of(*d));
+            }
+        }
+        else
+        {
+            // Position x maps to bit x + shift of the forward or the reversed exclusion bitset
+            const uint64_t *diag_bits = reversed ? reversed_excluded.data() : excluded.data();
+            const int64_t shift = reversed ? rows + cols - 2 - base : base;
+            for (int64_t word = lo >> 6; word <= (hi - 1) >> 6; word++)
+            {
+                uint64_t mask = ~uint64_t(0);
+                if (word == lo >> 6)
+                {
+                    mask &= ~uint64_t(0) << (lo & 63);
+                }
+                if (word == (hi - 1) >> 6 && (hi & 63))
+                {
+                    mask &= ~uint64_t(0) >> (64 - (hi & 63));
+                }
+                total += __builtin_popcountll(bits[word] & mask & ~bits_at(diag_bits, (word << 6) + shift));
+            }
+        }
+        return total;
     }
 
+    int64_t rows, cols;
+    bool symmetric;
+    const MatrixSelection &selection;
+    std::vector<int64_t> sorted_rows, sorted_cols;
+    std::vector<uint64_t> excluded, reversed_excluded;
+    std::vector<int64_t> kept_diags, excluded_diags;
+};
+
+// Concatenates column blocks into CSC storage. col_nnz holds every column's count and block_rows[b] the
+// sorted rows of the columns of block b back to back, starting at column block_first_col[b]; the outer
+// index is a prefix sum, so blocks copy in parallel.
+static Eigen::SparseMatrix<bool, 0, int64_t> concatenate_column_blocks(int64_t rows, int64_t cols, const std::vector<int64_t> &col_nnz, const std::vector<int64_t> &block_first_col,
+                                    const std::vector<std::vector<int64_t>> &block_rows, int num_threads)
+{
     Eigen::SparseMatrix<bool, 0, int64_t> matrix(rows, cols);
-    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    int64_t *outer = matrix.outerIndexPtr();
+    std::partial_sum(col_nnz.begin(), col_nnz.end(), outer + 1);
+
+    matrix.resizeNonZeros(outer[cols]);
+    std::fill_n(matrix.valuePtr(), outer[cols], true);
+    int64_t *inner = matrix.innerIndexPtr();
+
+    parallel_for(block_rows.size(), 1, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t b = begin; b < end; b++)
+        {
+            std::copy(block_rows[b].begin(), block_rows[b].end(), inner + outer[block_first_col[b]]);
+        }
+    });
 
     return matrix;
 }
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric)
+// Samples min(target_nnz, eligible) cells uniformly from the eligible cells of selection: every column
+// is counted exactly, the target is split over column blocks and then over the columns of each block,
+// and every column samples its share. Blocks draw from substreams of (seed, stream), so the result does
+// not depend on num_threads.
+// When no cell is eligible the diagonal exclusion is dropped; when the selected rows and cols still leave
+// none, one more row or col is selected so that a diagonal cell becomes eligible, the way the baseline
+// loosened its parameters and retried, and the matrix is never left empty.
+static Eigen::SparseMatrix<bool, 0, int64_t> sample_eligible_cells(int64_t rows, int64_t cols, int64_t target_nnz, bool symmetric, MatrixSelection &selection,
+                                    RandomEngine &gen, uint64_t seed, uint64_t stream, int num_threads)
 {
-    return generate_matrix_helper(rows, cols, max_nnz, nnz_sparsity, row_sparsity, col_sparsity, diag_sparsity, symmetric, 0);
-}
+    std::vector<int64_t> col_prefix(cols + 1, 0);
+    auto count_columns = [&](const EligibleColumns &eligible)
+    {
+        parallel_for(cols, generator_block_cols, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            for (int64_t j = begin; j < end; j++)
+            {
+                col_prefix[j + 1] = eligible.count(j);
+            }
+        });
+        std::partial_sum(col_prefix.begin(), col_prefix.end(), col_prefix.begin());
+        return col_prefix[cols];
+    };
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_row(int64_t size, int64_t max_nnz, float nnz_sparsity)
-{
-    auto engine = std::default_random_engine{};
-    std::bernoulli_distribution dist(1.0 - nnz_sparsity);
-    
-    std::vector<Eigen::Triplet<bool, int64_t>> triplets;
-    for (int64_t i = 0; i < size; i++)
+    std::unique_ptr<EligibleColumns> eligible = std::make_unique<EligibleColumns>(rows, cols, symmetric, selection);
+    if (count_columns(*eligible) == 0)
     {
-        if (dist(engine))
+        std::fill(selection.excluded_diags_bits.begin(), selection.excluded_diags_bits.end(), 0);
+        eligible = std::make_unique<EligibleColumns>(rows, cols, symmetric, selection);
+        std::fill(col_prefix.begin(), col_prefix.end(), 0);
+        if (count_columns(*eligible) == 0)
         {
-            triplets.emplace_back(0, i, 1);
+            // Only symmetric selections whose cols all lie right of their rows get here. Selecting the
+            // smallest col as a row, or the smallest row as a col when that col is past the last row,
+            // makes the diagonal cell (d, d) eligible.
+            const int64_t first_col = *std::min_element(selection.cols.begin(), selection.cols.end());
+            const int64_t first_row = *std::min_element(selection.rows.begin(), selection.rows.end());
+            if (first_col < rows)
+            {
+                selection.rows.push_back(first_col);
+                bitset_set(selection.rows_bits.data(), first_col);
+            }
+            else
+            {
+                selection.cols.push_back(first_row);
+                bitset_set(selection.cols_bits.data(), first_row);
+            }
+            eligible = std::make_unique<EligibleColumns>(rows, cols, symmetric, selection);
+            std::fill(col_prefix.begin(), col_prefix.end(), 0);
+            count_columns(*eligible);
         }
     }
+    target_nnz = std::min(target_nnz, col_prefix[cols]);
+
+    const int64_t blocks = (cols + generator_block_cols - 1) / generator_block_cols;
+    std::vector<int64_t> block_prefix(blocks + 1), block_target(blocks), block_first_col(blocks);
+    for (int64_t b = 0; b < blocks; b++)
+    {
+        block_first_col[b] = b * generator_block_cols;
+        block_prefix[b] = col_prefix[block_first_col[b]];
+    }
+    block_prefix[blocks] = col_prefix[cols];
+    hypergeometric_split(gen, block_prefix.data(), 0, blocks, target_nnz, block_target.data());
 
-    Eigen::SparseMatrix<bool, 0, int64_t> matrix(size, size);
-    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    std::vector<int64_t> col_nnz(cols, 0);
+    std::vector<std::vector<int64_t>> block_rows(blocks);
+    const int thread_count = parallel_thread_count(blocks, 1, num_threads);
+    std::vector<std::vector<uint64_t>> seen(thread_count);
+    std::vector<std::vector<int64_t>> candidates(thread_count);
 
-    return matrix;
+    parallel_for(blocks, 1, num_threads, [&](int64_t begin, int64_t end, int thread)
+    {
+        seen[thread].resize(bitset_words(rows), 0);
+        for (int64_t b = begin; b < end; b++)
+        {
+            RandomEngine block_gen(seed, stream, b + 1);
+            const int64_t first = block_first_col[b], last = std::min(first + generator_block_cols, cols);
+            hypergeometric_split(block_gen, col_prefix.data(), first, last, block_target[b], col_nnz.data());
+
+            block_rows[b].reserve(block_target[b]);
+            for (int64_t j = first; j < last; j++)
+            {
+                eligible->sample(j, col_nnz[j], col_prefix[j + 1] - col_prefix[j], block_gen, seen[thread], candidates[thread], block_rows[b]);
+            }
+        }
+    });
+
+    return concatenate_column_blocks(rows, cols, col_nnz, block_first_col, block_rows, num_threads);
 }
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_col(int64_t size, int64_t max_nnz, float nnz_sparsity)
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_helper(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed, uint64_t stream)
 {
-    auto engine = std::default_random_engine{};
-    std::bernoulli_distribution dist(1.0 - nnz_sparsity);
-    
-    std::vector<Eigen::Triplet<bool, int64_t>> triplets;
-    for (int64_t i = 0; i < size; i++)
+    RandomEngine gen(seed, stream);
+
+    MatrixSelection selection = select_rows_cols_diags(gen, rows, cols, row_sparsity, col_sparsity, diag_sparsity);
+    const std::vector<int64_t> &selected_rows = selection.rows;
+    const std::vector<int64_t> &selected_cols = selection.cols;
+
+    auto diag_excluded = [&](int64_t row, int64_t col)
     {
-        if (!dist(engine))
+        return selection.diag_excluded(row, col);
+    };
+
+    // Cells are drawn as items of the candidate space selected rows x selected cols. In the symmetric
+    // case every lower-triangle cell (row, col) is an item and so is its mirror (col, row) when that fits
+    // in the matrix, so each draw also flips a coin for which of the two it stands for.
+    const int64_t space = static_cast<int64_t>(selected_rows.size()) * selected_cols.size() * (symmetric ? 2 : 1);
+
+    // Draws one item, returns false when it falls outside the eligible set
+    auto draw = [&](int64_t &row, int64_t &col)
+    {
+        row = selected_rows[uniform_below(gen, selected_rows.size())];
+        col = selected_cols[uniform_below(gen, selected_cols.size())];
+        bool mirror = symmetric && (gen() >> 63);
+        if (diag_excluded(row, col) || (symmetric && col > row))
         {
-            triplets.emplace_back(i, 0, 1);
+            return false;
         }
+        if (mirror)
+        {
+            if (row == col || row >= cols)
+            {
+                return false;
+            }
+            std::swap(row, col);
+        }
+        return true;
+    };
+
+    int64_t target_nnz = std::max(int64_t(0), std::min(max_nnz, static_cast<int64_t>(rows * cols * (1.0 - nnz_sparsity))));
+    if (target_nnz == 0)
+    {
+        return Eigen::SparseMatrix<bool, 0, int64_t>(rows, cols);
     }
 
-    Eigen::SparseMatrix<bool, 0, int64_t> matrix(size, size);
-    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    // Pilot draws estimate how much of the candidate space is eligible
+    const int64_t pilot_draws = std::min(space, int64_t(4096));
+    int64_t pilot_hits = 0;
+    for (int64_t i = 0; i < pilot_draws; i++)
+    {
+        int64_t row, col;
+        pilot_hits += draw(row, col);
+    }
+    double estimated_eligible = static_cast<double>(pilot_hits) / pilot_draws * space;
 
-    return matrix;
+    if (pilot_hits == 0 || target_nnz * 2 > estimated_eligible)
+    {
+        // The eligible set is small next to the target or the candidate space: count it exactly and
+        // sample it column by column, which also settles infeasible parameters without retrying
+        return sample_eligible_cells(rows, cols, target_nnz, symmetric, selection, gen, seed, stream, 1);
+    }
+
+    // Rejection sampling: cost follows the nnz emitted, with a bounded budget in case the
+    // estimate was optimistic
+    std::vector<std::pair<int64_t, int64_t>> cells;
+    std::unordered_set<int64_t> chosen;
+    chosen.reserve(target_nnz);
+    cells.reserve(target_nnz);
+    const int64_t max_draws = 64 * (target_nnz + 1) * std::max(int64_t(1), static_cast<int64_t>(space / estimated_eligible));
+    for (int64_t i = 0; i < max_draws && static_cast<int64_t>(cells.size()) < target_nnz; i++)
+    {
+        int64_t row, col;
+        if (draw(row, col) && chosen.insert(row * cols + col).second)
+        {
+            cells.emplace_back(row, col);
+        }
+    }
+
+    // The estimate was too optimistic to reach the target within budget: start over on the exact path
+    // rather than return fewer cells than asked for
+    if (static_cast<int64_t>(cells.size()) < target_nnz)
+    {
+        return sample_eligible_cells(rows, cols, target_nnz, symmetric, selection, gen, seed, stream, 1);
+    }
+
+    return build_pattern_matrix(rows, cols, cells);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed, uint64_t stream)
+{
+    return generate_matrix_helper(rows, cols, max_nnz, nnz_sparsity, row_sparsity, col_sparsity, diag_sparsity, symmetric, resolve_seed(seed), stream);
 }
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_cols(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity)
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_row(int64_t size, [[maybe_unused]] int64_t max_nnz, float nnz_sparsity, uint64_t seed, uint64_t stream)
 {
-    std::random_device rd;
-    std::default_random_engine gen(rd());
-    std::bernoulli_distribution nnz_dist(1.0 - nnz_sparsity);
+    RandomEngine engine(resolve_seed(seed), stream);
+
+    std::vector<std::pair<int64_t, int64_t>> cells;
+    bernoulli_positions(engine, size, 1.0 - nnz_sparsity, [&](int64_t i) { cells.emplace_back(0, i); });
+
+    return build_pattern_matrix(size, size, cells);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_col(int64_t size, [[maybe_unused]] int64_t max_nnz, float nnz_sparsity, uint64_t seed, uint64_t stream)
+{
+    RandomEngine engine(resolve_seed(seed), stream);
+
+    // A cell is kept when the nnz draw fails, so with probability nnz_sparsity
+    std::vector<std::pair<int64_t, int64_t>> cells;
+    bernoulli_positions(engine, size, nnz_sparsity, [&](int64_t i) { cells.emplace_back(i, 0); });
+
+    return build_pattern_matrix(size, size, cells);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_cols(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, uint64_t seed, uint64_t stream)
+{
+    RandomEngine gen(resolve_seed(seed), stream);
 
-    std::unordered_set<int64_t> selected_rows_set;
     int64_t target_rows_count = std::round(rows * (1.0 - row_sparsity));
     target_rows_count = std::max(target_rows_count, int64_t(1));
 
-    for (int64_t i = 0; i < target_rows_count * 100; ++i)
+    std::vector<uint64_t> selected_rows_bits;
+    std::vector<int64_t> selected_rows = sample_distinct(gen, rows, target_rows_count, selected_rows_bits, uniform_draw);
+
+    // Position t of the selected rows is cell (selected_rows[t / cols], t % cols)
+    std::vector<std::pair<int64_t, int64_t>> cells;
+    bernoulli_subset(gen, static_cast<int64_t>(selected_rows.size()) * cols, 1.0 - nnz_sparsity, max_nnz, [&](int64_t t)
+    {
+        cells.emplace_back(selected_rows[t / cols], t % cols);
+    });
+
+    return build_pattern_matrix(rows, cols, cells);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity, uint64_t seed, uint64_t stream)
+{
+    RandomEngine gen(resolve_seed(seed), stream);
+
+    int64_t target_cols_count = std::round(cols * (1.0 - col_sparsity));
+    target_cols_count = std::max(target_cols_count, int64_t(1));
+
+    std::vector<uint64_t> selected_cols_bits;
+    std::vector<int64_t> selected_cols = sample_distinct(gen, cols, target_cols_count, selected_cols_bits, uniform_draw);
+
+    // Position t of the selected cols is cell (t % rows, selected_cols[t / rows])
+    std::vector<std::pair<int64_t, int64_t>> cells;
+    bernoulli_subset(gen, static_cast<int64_t>(selected_cols.size()) * rows, 1.0 - nnz_sparsity, max_nnz, [&](int64_t t)
+    {
+        cells.emplace_back(t % rows, selected_cols[t / rows]);
+    });
+
+    return build_pattern_matrix(rows, cols, cells);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_parallel(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed, uint64_t stream, int num_threads)
+{
+    seed = resolve_seed(seed);
+    RandomEngine gen(seed, stream);
+
+    MatrixSelection selection = select_rows_cols_diags(gen, rows, cols, row_sparsity, col_sparsity, diag_sparsity);
+    int64_t target_nnz = std::max(int64_t(0), std::min(max_nnz, static_cast<int64_t>(rows * cols * (1.0 - nnz_sparsity))));
+
+    return sample_eligible_cells(rows, cols, target_nnz, symmetric, selection, gen, seed, stream, num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows_parallel(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity, uint64_t seed, uint64_t stream, int num_threads)
+{
+    seed = resolve_seed(seed);
+    RandomEngine gen(seed, stream);
+
+    int64_t target_cols_count = std::round(cols * (1.0 - col_sparsity));
+    target_cols_count = std::max(target_cols_count, int64_t(1));
+
+    std::vector<uint64_t> selected_cols_bits;
+    std::vector<int64_t> selected_cols = sample_distinct(gen, cols, target_cols_count, selected_cols_bits, uniform_draw);
+    std::sort(selected_cols.begin(), selected_cols.end());
+
+    // Blocks of selected cols draw their cells from their own substreams
+    const int64_t selected = selected_cols.size();
+    const int64_t blocks = (selected + generator_block_cols - 1) / generator_block_cols;
+    std::vector<int64_t> col_nnz(cols, 0), block_first_col(blocks);
+    std::vector<std::vector<int64_t>> block_rows(blocks);
+    for (int64_t b = 0; b < blocks; b++)
     {
-        if (selected_rows_set.size() >= target_rows_count)
+        block_first_col[b] = selected_cols[b * generator_block_cols];
+    }
+
+    const double p = std::max(0.0, std::min(1.0, 1.0 - nnz_sparsity));
+    max_nnz = std::max(int64_t(0), max_nnz);
+    std::vector<int64_t> block_prefix(blocks + 1, 0), block_target(blocks);
+
+    if (p * selected * rows > 2.0 * max_nnz)
+    {
+        // Truncation would discard most cells: draw how many come up, keep a uniform subset of max_nnz
+        // of the whole space and split it over the blocks and then their columns, like bernoulli_subset
+        int64_t count = std::min(max_nnz, std::binomial_distribution<int64_t>(selected * rows, p)(gen));
+        for (int64_t b = 0; b < blocks; b++)
         {
-            break;
+            block_prefix[b + 1] = std::min(selected, (b + 1) * generator_block_cols) * rows;
         }
-        selected_rows_set.insert(std::uniform_int_distribution<int64_t>(0, rows - 1)(gen));
+        hypergeometric_split(gen, block_prefix.data(), 0, blocks, count, block_target.data());
+
+        parallel_for(blocks, 1, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            std::vector<int64_t> prefix, counts;
+            for (int64_t b = begin; b < end; b++)
+            {
+                RandomEngine block_gen(seed, stream, b + 1);
+                const int64_t first = b * generator_block_cols, last = std::min(selected, first + generator_block_cols);
+
+                prefix.resize(last - first + 1);
+                for (int64_t i = 0; i <= last - first; i++)
+                {
+                    prefix[i] = i * rows;
+                }
+                counts.assign(last - first, 0);
+                hypergeometric_split(block_gen, prefix.data(), 0, last - first, block_target[b], counts.data());
+
+                block_rows[b].reserve(block_target[b]);
+                for (int64_t i = 0; i < last - first; i++)
+                {
+                    size_t start = block_rows[b].size();
+                    uniform_positions(block_gen, rows, counts[i], [&](int64_t row) { block_rows[b].push_back(row); });
+                    std::sort(block_rows[b].begin() + start, block_rows[b].end());
+                    col_nnz[selected_cols[first + i]] = counts[i];
+                }
+            }
+        });
+
+        return concatenate_column_blocks(rows, cols, col_nnz, block_first_col, block_rows, num_threads);
     }
 
-    std::vector<int64_t> selected_rows(selected_rows_set.begin(), selected_rows_set.end());
+    parallel_for(blocks, 1, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t b = begin; b < end; b++)
+        {
+            RandomEngine block_gen(seed, stream, b + 1);
+            for (int64_t i = b * generator_block_cols; i < std::min(selected, (b + 1) * generator_block_cols); i++)
+            {
+                size_t start = block_rows[b].size();
+                bernoulli_positions(block_gen, rows, p, [&](int64_t row) { block_rows[b].push_back(row); });
+                col_nnz[selected_cols[i]] = block_rows[b].size() - start;
+            }
+        }
+    });
+
+    for (int64_t b = 0; b < blocks; b++)
+    {
+        block_prefix[b + 1] = block_prefix[b] + block_rows[b].size();
+    }
+
+    if (block_prefix[blocks] > max_nnz)
+    {
+        // Keep a uniform subset of max_nnz cells: split it over the blocks, then over the columns of each
+        // block, and truncate every column to its share
+        hypergeometric_split(gen, block_prefix.data(), 0, blocks, max_nnz, block_target.data());
+
+        parallel_for(blocks, 1, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            std::vector<int64_t> prefix, counts, column;
+            for (int64_t b = begin; b < end; b++)
+            {
+                RandomEngine block_gen(seed, stream, blocks + b + 1);
+                const int64_t first = b * generator_block_cols, last = std::min(selected, first + generator_block_cols);
+
+                prefix.assign(1, 0);
+                for (int64_t i = first; i < last; i++)
+                {
+                    prefix.push_back(prefix.back() + col_nnz[selected_cols[i]]);
+                }
+                counts.assign(last - first, 0);
+                hypergeometric_split(block_gen, prefix.data(), 0, last - first, block_target[b], counts.data());
+
+                int64_t kept = 0;
+                for (int64_t i = 0; i < last - first; i++)
+                {
+                    column.assign(block_rows[b].begin() + prefix[i], block_rows[b].begin() + prefix[i + 1]);
+                    partial_shuffle(column, counts[i], block_gen);
+                    std::sort(column.begin(), column.end());
+                    std::copy(column.begin(), column.end(), block_rows[b].begin() + kept);
+                    kept += counts[i];
+                    col_nnz[selected_cols[first + i]] = counts[i];
+                }
+                block_rows[b].resize(kept);
+            }
+        });
+    }
+
+    return concatenate_column_blocks(rows, cols, col_nnz, block_first_col, block_rows, num_threads);
+}
+
+// R-MAT cells come in chunks drawn from their own substreams, so the counting and scattering passes replay
+// the same cells and the result does not depend on the thread count
+static constexpr int64_t rmat_chunk_cells = int64_t(1) << 16;
+
+// R-MAT draws are deduplicated in one band of columns per rmat_band_cells draws, but in no more than
+// rmat_max_bands bands: every band replays all draws twice
+static constexpr int64_t rmat_band_cells = int64_t(1) << 24;
+static constexpr int64_t rmat_max_bands = 8;
+
+// Draws R-MAT cells: every level of the descent picks a quadrant with probabilities a, b, c and
+// 1 - a - b - c, setting one bit of the row and col. When one dimension needs more bits, its extra
+// leading bits follow its marginal (c + d for rows, b + d for cols). Cells beyond rows or cols are drawn
+// again.
+class RmatSampler
+{
+public:
+    RmatSampler(int64_t rows, int64_t cols, double a, double b, double c)
+        : rows(rows), cols(cols), row_bits(index_bits(rows)), col_bits(index_bits(cols))
+    {
+        levels = std::max(row_bits, col_bits);
+        shared_levels = std::min(row_bits, col_bits);
+        both[0] = threshold(a);
+        both[1] = threshold(a + b);
+        both[2] = threshold(a + b + c);
+        col_only = threshold(a + c);
+    }
 
-    std::vector<Eigen::Triplet<bool, int64_t>> triplets;
-    for (const auto& row : selected_rows)
+    void operator()(RandomEngine &gen, int64_t &row, int64_t &col)
     {
-        for (int64_t col = 0; col < cols; ++col)
+        do
         {
-            if (nnz_dist(gen))
+            row = 0;
+            col = 0;
+            // The levels above the shorter dimension's bits set only the longer one
+            for (int level = levels - 1; level >= shared_levels; level--)
             {
-                triplets.emplace_back(row, col, true);
+                const uint64_t u = next_uniform(gen);
+                if (row_bits > col_bits)
+                {
+                    row = row << 1 | (u >= both[1]);
+                }
+                else
+                {
+                    col = col << 1 | (u >= col_only);
+                }
             }
+            // The col bit is set in the second and fourth quadrants, so it is the parity of the thresholds
+            // passed, which keeps the descent free of branches
+            for (int level = shared_levels - 1; level >= 0; level--)
+            {
+                const uint64_t u = next_uniform(gen);
+                const int64_t past0 = u >= both[0], past1 = u >= both[1], past2 = u >= both[2];
+                row = row << 1 | past1;
+                col = col << 1 | (past0 ^ past1 ^ past2);
+            }
+        } while (row >= rows || col >= cols);
+    }
+
+private:
+    // Bits needed to index [0, n)
+    static int index_bits(int64_t n)
+    {
+        int bits = 0;
+        while ((int64_t(1) << bits) < n)
+        {
+            bits++;
         }
+        return bits;
     }
 
-    if (triplets.size() > max_nnz)
+    // Each level uses 32 bits of an engine output
+    uint64_t next_uniform(RandomEngine &gen)
     {
-        std::shuffle(triplets.begin(), triplets.end(), gen);
-        triplets.resize(max_nnz);
+        if (available == 0)
+        {
+            bits = gen();
+            available = 2;
+        }
+        const uint64_t u = static_cast<uint32_t>(bits);
+        bits >>= 32;
+        available--;
+        return u;
+    }
+
+    // Probability as a bound on 32-bit uniforms
+    static uint64_t threshold(double probability)
+    {
+        return static_cast<uint64_t>(std::min(1.0, probability) * 4294967296.0);
+    }
+
+    int64_t rows, cols;
+    int row_bits, col_bits, levels, shared_levels;
+    uint64_t both[3], col_only;
+    uint64_t bits = 0;
+    int available = 0;
+};
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_rmat(int64_t rows, int64_t cols, int64_t cells, float a, float b, float c, uint64_t seed, uint64_t stream, int num_threads)
+{
+    if (a < 0 || b < 0 || c < 0 || a + b + c > 1.0f + 1e-6f)
+    {
+        std::cerr << "R-MAT probabilities a " << a << ", b " << b << ", c " << c << " must be non-negative with a sum of at most 1" << std::endl;
+        return Eigen::SparseMatrix<bool, 0, int64_t>(std::max(int64_t(0), rows), std::max(int64_t(0), cols));
+    }
+    if (rows <= 0 || cols <= 0 || cells <= 0)
+    {
+        return Eigen::SparseMatrix<bool, 0, int64_t>(std::max(int64_t(0), rows), std::max(int64_t(0), cols));
+    }
+
+    seed = resolve_seed(seed);
+    const RmatSampler sampler(rows, cols, a, b, c);
+    const int64_t chunks = (cells + rmat_chunk_cells - 1) / rmat_chunk_cells;
+
+    auto for_each_cell = [&](int64_t chunk, auto &&visit)
+    {
+        RandomEngine gen(seed, stream, static_cast<uint32_t>(chunk + 1));
+        RmatSampler chunk_sampler = sampler;
+        const int64_t count = std::min(rmat_chunk_cells, cells - chunk * rmat_chunk_cells);
+        for (int64_t i = 0; i < count; i++)
+        {
+            int64_t row, col;
+            chunk_sampler(gen, row, col);
+            visit(row, col);
+        }
+    };
+
+    // Draws per column, repeats included
+    std::vector<std::atomic<int64_t>> col_cursor(cols);
+    parallel_for(chunks, 1, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t chunk = begin; chunk < end; chunk++)
+        {
+            for_each_cell(chunk, [&](int64_t, int64_t col) { col_cursor[col].fetch_add(1, std::memory_order_relaxed); });
+        }
+    });
+
+    std::vector<int64_t> draw_offset(cols + 1, 0);
+    for (int64_t j = 0; j < cols; j++)
+    {
+        draw_offset[j + 1] = draw_offset[j] + col_cursor[j].load(std::memory_order_relaxed);
+    }
+
+    // Repeated cells collapse into one nonzero, so the matrix is sized from distinct counts. Those are only
+    // known after deduplicating, which happens in bands of consecutive columns; every band replays all
+    // draws and keeps its own columns. Band b starts at the first column whose draws start at or past
+    // b / bands of all draws, so there are never more than rmat_max_bands of them, each about
+    // cells / bands draws plus at most one column straddling its end.
+    const int64_t band_count = std::min(rmat_max_bands, std::max(int64_t(1), (cells + rmat_band_cells - 1) / rmat_band_cells));
+    std::vector<int64_t> band_first_col(band_count + 1, cols);
+    band_first_col[0] = 0;
+    for (int64_t band = 1; band < band_count; band++)
+    {
+        band_first_col[band] = std::lower_bound(draw_offset.begin(), draw_offset.end() - 1, cells / band_count * band) - draw_offset.begin();
+    }
+    band_first_col.erase(std::unique(band_first_col.begin(), band_first_col.end()), band_first_col.end());
+    const int64_t bands = band_first_col.size() - 1;
+
+    // Leaves the sorted distinct rows of every column of the band at the start of its slot in buffer
+    std::vector<int64_t> buffer, col_distinct(cols);
+    auto deduplicate_band = [&](int64_t band)
+    {
+        const int64_t first = band_first_col[band], last = band_first_col[band + 1], base = draw_offset[first];
+        buffer.resize(draw_offset[last] - base);
+        for (int64_t j = first; j < last; j++)
+        {
+            col_cursor[j].store(draw_offset[j] - base, std::memory_order_relaxed);
+        }
+
+        parallel_for(chunks, 1, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            for (int64_t chunk = begin; chunk < end; chunk++)
+            {
+                for_each_cell(chunk, [&](int64_t row, int64_t col)
+                {
+                    if (col >= first && col < last)
+                    {
+                        buffer[col_cursor[col].fetch_add(1, std::memory_order_relaxed)] = row;
+                    }
+                });
+            }
+        });
+
+        parallel_for(last - first, 4096, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            for (int64_t j = first + begin; j < first + end; j++)
+            {
+                int64_t *column = buffer.data() + draw_offset[j] - base;
+                std::sort(column, column + draw_offset[j + 1] - draw_offset[j]);
+                col_distinct[j] = std::unique(column, column + draw_offset[j + 1] - draw_offset[j]) - column;
+            }
+        });
+    };
+
+    for (int64_t band = 0; band < bands; band++)
+    {
+        deduplicate_band(band);
     }
 
     Eigen::SparseMatrix<bool, 0, int64_t> matrix(rows, cols);
-    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    int64_t *outer = matrix.outerIndexPtr();
+    for (int64_t j = 0; j < cols; j++)
+    {
+        outer[j + 1] = outer[j] + col_distinct[j];
+    }
+    const int64_t nnz = outer[cols];
+    matrix.resizeNonZeros(nnz);
 
+    // A single band is still in the buffer, more are deduplicated again to be copied out
+    int64_t *inner = matrix.innerIndexPtr();
+    for (int64_t band = 0; band < bands; band++)
+    {
+        if (bands > 1)
+        {
+            deduplicate_band(band);
+        }
+        const int64_t first = band_first_col[band], base = draw_offset[first];
+        parallel_for(band_first_col[band + 1] - first, 4096, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            for (int64_t j = first + begin; j < first + end; j++)
+            {
+                std::copy_n(buffer.data() + draw_offset[j] - base, col_distinct[j], inner + outer[j]);
+            }
+        });
+    }
+    std::vector<int64_t>().swap(buffer);
+
+    std::fill_n(matrix.valuePtr(), nnz, true);
     return matrix;
 }
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity)
+// Matrix whose column j can only hold the rows [first, last) given by row_range(j), each kept with
+// probability fill. Blocks of columns draw from their own substreams with geometric skips, so the cost
+// follows the cells in range rather than rows * cols and the result does not depend on num_threads.
+template <typename RowRange>
+static Eigen::SparseMatrix<bool, 0, int64_t> generate_column_ranges(int64_t rows, int64_t cols, float fill, RowRange &&row_range, uint64_t seed, uint64_t stream, int num_threads)
 {
-    std::random_device rd;
-    std::default_random_engine gen(rd());
-    std::bernoulli_distribution nnz_dist(1.0 - nnz_sparsity);
+    seed = resolve_seed(seed);
+    const double p = std::max(0.0, std::min(1.0, static_cast<double>(fill)));
 
-    std::unordered_set<int64_t> selected_cols_set;
-    int64_t target_cols_count = std::round(cols * (1.0 - col_sparsity));
-    target_cols_count = std::max(target_cols_count, int64_t(1));
+    const int64_t blocks = (cols + generator_block_cols - 1) / generator_block_cols;
+    std::vector<int64_t> col_nnz(cols, 0), block_first_col(blocks);
+    std::vector<std::vector<int64_t>> block_rows(blocks);
 
-    for (int64_t i = 0; i < target_cols_count * 100; ++i)
+    parallel_for(blocks, 1, num_threads, [&](int64_t begin, int64_t end, int)
     {
-        if (selected_cols_set.size() >= target_cols_count)
+        for (int64_t b = begin; b < end; b++)
         {
-            break;
+            RandomEngine block_gen(seed, stream, b + 1);
+            block_first_col[b] = b * generator_block_cols;
+            for (int64_t j = b * generator_block_cols; j < std::min(cols, (b + 1) * generator_block_cols); j++)
+            {
+                int64_t first, last;
+                row_range(j, first, last);
+                first = std::max(int64_t(0), first);
+                last = std::min(rows, last);
+
+                size_t start = block_rows[b].size();
+                bernoulli_positions(block_gen, last - first, p, [&](int64_t i) { block_rows[b].push_back(first + i); });
+                col_nnz[j] = block_rows[b].size() - start;
+            }
         }
-        selected_cols_set.insert(std::uniform_int_distribution<int64_t>(0, cols - 1)(gen));
+    });
+
+    return concatenate_column_blocks(rows, cols, col_nnz, block_first_col, block_rows, num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_banded(int64_t rows, int64_t cols, int64_t bandwidth, float fill, uint64_t seed, uint64_t stream, int num_threads)
+{
+    if (bandwidth < 0)
+    {
+        std::cerr << "Bandwidth " << bandwidth << " must be non-negative" << std::endl;
+        return Eigen::SparseMatrix<bool, 0, int64_t>(rows, cols);
     }
 
-    std::vector<int64_t> selected_cols(selected_cols_set.begin(), selected_cols_set.end());
+    return generate_column_ranges(rows, cols, fill, [&](int64_t j, int64_t &first, int64_t &last)
+    {
+        first = j - std::min(j, bandwidth);
+        last = j + std::min(rows, bandwidth) + 1;
+    }, seed, stream, num_threads);
+}
 
-    std::vector<Eigen::Triplet<bool, int64_t>> triplets;
-    for (int64_t row = 0; row < rows; ++row)
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_block_diagonal(int64_t rows, int64_t cols, int64_t block_size, float fill, uint64_t seed, uint64_t stream, int num_threads)
+{
+    if (block_size <= 0)
     {
-        for (const auto& col : selected_cols)
+        std::cerr << "Block size " << block_size << " must be positive" << std::endl;
+        return Eigen::SparseMatrix<bool, 0, int64_t>(rows, cols);
+    }
+
+    return generate_column_ranges(rows, cols, fill, [&](int64_t j, int64_t &first, int64_t &last)
+    {
+        first = j / block_size * block_size;
+        last = first + std::min(rows, block_size);
+    }, seed, stream, num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_stencil(int64_t nx, int64_t ny, int64_t nz, int points, int num_threads)
+{
+    if (points != 5 && points != 7 && points != 27)
+    {
+        std::cerr << "Unknown stencil of " << points << " points, expected 5, 7 or 27" << std::endl;
+        return Eigen::SparseMatrix<bool, 0, int64_t>();
+    }
+    if (nx <= 0 || ny <= 0 || nz <= 0)
+    {
+        std::cerr << "Stencil grid " << nx << "x" << ny << "x" << nz << " must have positive dimensions" << std::endl;
+        return Eigen::SparseMatrix<bool, 0, int64_t>();
+    }
+
+    // Neighbour offsets in z, y, x order, which is ascending order of the linear index
+    std::vector<std::array<int64_t, 3>> offsets;
+    for (int64_t dz = -1; dz <= 1; dz++)
+    {
+        for (int64_t dy = -1; dy <= 1; dy++)
         {
-            if (nnz_dist(gen))
+            for (int64_t dx = -1; dx <= 1; dx++)
             {
-                triplets.emplace_back(row, col, true);
+                const int64_t distance = std::abs(dx) + std::abs(dy) + std::abs(dz);
+                if (points == 27 || (distance <= 1 && (points == 7 || dz == 0)))
+                {
+                    offsets.push_back({dx, dy, dz});
+                }
             }
         }
     }
 
-    if (triplets.size() > max_nnz)
+    // Visits the rows of grid point j's column: every neighbour inside the grid
+    auto for_each_neighbour = [&](int64_t j, auto &&visit)
     {
-        std::shuffle(triplets.begin(), triplets.end(), gen);
-        triplets.resize(max_nnz);
-    }
+        const int64_t x = j % nx, y = j / nx % ny, z = j / (nx * ny);
+        for (const auto &offset : offsets)
+        {
+            const int64_t i = x + offset[0], k = y + offset[1], l = z + offset[2];
+            if (i >= 0 && i < nx && k >= 0 && k < ny && l >= 0 && l < nz)
+            {
+                visit(i + nx * (k + ny * l));
+            }
+        }
+    };
 
-    Eigen::SparseMatrix<bool, 0, int64_t> matrix(rows, cols);
-    matrix.setFromTriplets(triplets.begin(), triplets.end());
+    const int64_t n = nx * ny * nz;
+    Eigen::SparseMatrix<bool, 0, int64_t> matrix(n, n);
+    int64_t *outer = matrix.outerIndexPtr();
+    parallel_for(n, 1 << 16, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t j = begin; j < end; j++)
+        {
+            int64_t count = 0;
+            for_each_neighbour(j, [&](int64_t) { count++; });
+            outer[j + 1] = count;
+        }
+    });
+    std::partial_sum(outer + 1, outer + n + 1, outer + 1);
+
+    matrix.resizeNonZeros(outer[n]);
+    std::fill_n(matrix.valuePtr(), outer[n], true);
+    int64_t *inner = matrix.innerIndexPtr();
+    parallel_for(n, 1 << 16, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t j = begin; j < end; j++)
+        {
+            int64_t position = outer[j];
+            for_each_neighbour(j, [&](int64_t row) { inner[position++] = row; });
+        }
+    });
 
     return matrix;
-}
\ No newline at end of file
+}
@@ -7,22 +7,56 @@
 #include <random>
 #include <boost/python.hpp>
 
+#include "Distributions.h"
+#include "Random.h"
+
 struct DataSetEntry
 {
     Eigen::SparseMatrix<bool, 0, int64_t> m1, m2, prod;
-    float m1_nnz_density, m2_nnz_density, product_nnz_density;
+    int64_t product_nnz, product_flops;
+    float m1_nnz_density, m2_nnz_density, product_nnz_density, product_compression_ratio;
 };
 
-std::function<int64_t(std::default_random_engine &)> select_random_generator(std::default_random_engine &gen, int64_t min_val, int64_t max_val, std::string debug_name = "");
+// Picks a uniform, normal or geometric distribution over [min_val, max_val] at random
+RandomGenerator select_random_generator(RandomEngine &gen, int64_t min_val, int64_t max_val, std::string debug_name = "");
+
+// Every generator draws from the counter-based stream (seed, stream), so the same pair always gives the
+// same matrix and distinct streams can run on separate threads. Seed 0 draws a fresh seed.
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed = 0, uint64_t stream = 0);
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_row(int64_t size, int64_t max_nnz, float nnz_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_col(int64_t size, int64_t max_nnz, float nnz_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_cols(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, uint64_t seed = 0, uint64_t stream = 0);
+
+// Column-block parallel variants of generate_matrix and generate_matrix_multiple_rows with the same
+// distribution. Blocks draw from substreams of (seed, stream), so the result does not depend on
+// num_threads (0 uses every hardware thread), though it differs from the serial generator's.
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_parallel(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric, uint64_t seed = 0, uint64_t stream = 0, int num_threads = 0);
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity, float col_sparsity, float diag_sparsity, bool symmetric);
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows_parallel(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity, uint64_t seed = 0, uint64_t stream = 0, int num_threads = 0);
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_row(int64_t size, int64_t max_nnz, float nnz_sparsity);
+// R-MAT (stochastic Kronecker) matrix with power-law row and column degrees: cells draws, each descending
+// the quadrants with probabilities a, b, c and 1 - a - b - c, with repeated draws collapsing into one
+// nonzero. Draws are replayed from their substreams rather than stored: the result is sized from distinct
+// counts and deduplicated in at most 8 column bands of about max(2^24, cells / 8) draws each, so memory is
+// the result plus one band of int64 rows (about 1 GB for 10^9 draws), and the draws are replayed at most
+// 2 * 8 + 1 times. The result does not depend on num_threads (0 uses every hardware thread).
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_rmat(int64_t rows, int64_t cols, int64_t cells, float a, float b, float c, uint64_t seed = 0, uint64_t stream = 0, int num_threads = 0);
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_one_col(int64_t size, int64_t max_nnz, float nnz_sparsity);
+// Structured generators that only visit the cells they may keep, so their cost is linear in nnz. Banded
+// keeps cells with |row - col| <= bandwidth, block diagonal the cells of the block_size x block_size
+// diagonal blocks, each with probability fill. Blocks of columns draw from substreams of (seed, stream),
+// so the result does not depend on num_threads (0 uses every hardware thread).
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_banded(int64_t rows, int64_t cols, int64_t bandwidth, float fill, uint64_t seed = 0, uint64_t stream = 0, int num_threads = 0);
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_cols(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float col_sparsity);
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_block_diagonal(int64_t rows, int64_t cols, int64_t block_size, float fill, uint64_t seed = 0, uint64_t stream = 0, int num_threads = 0);
 
-Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_multiple_rows(int64_t rows, int64_t cols, int64_t max_nnz, float nnz_sparsity, float row_sparsity);
+// Adjacency of an nx x ny x nz grid (nz = 1 for 2D) under a 5-point (2D), 7-point or 27-point (3D)
+// stencil, grid points numbered x fastest. The pattern is fixed, so it takes no seed.
+Eigen::SparseMatrix<bool, 0, int64_t> generate_matrix_stencil(int64_t nx, int64_t ny, int64_t nz, int points, int num_threads = 0);
 
 #endif // MATRIX_GENERATOR_H
@@ -2,13 +2,41 @@
 #include "MatrixGenerator.h"
 #include "EntryGenerator.h"
 
+// seed and stream are optional trailing arguments of every entry generator
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_rectangle_matrices_overloads, generate_entry_rectangle_matrices, 15, 17)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_square_matrices_overloads, generate_entry_square_matrices, 13, 15)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_inner_product_overloads, generate_entry_inner_product, 4, 6)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_outer_product_overloads, generate_entry_outer_product, 4, 6)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_extreme_cases_overloads, generate_entry_extreme_cases, 7, 9)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_rmat_overloads, generate_entry_rmat, 9, 11)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_banded_overloads, generate_entry_banded, 5, 7)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entry_block_diagonal_overloads, generate_entry_block_diagonal, 5, 7)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entries_rectangle_matrices_overloads, generate_entries_rectangle_matrices, 2, 6)
+BOOST_PYTHON_FUNCTION_OVERLOADS(generate_entries_square_matrices_overloads, generate_entries_square_matrices, 2, 6)
+BOOST_PYTHON_FUNCTION_OVERLOADS(read_matrix_market_indices_overloads, read_matrix_market_indices, 1, 2)
+
 BOOST_PYTHON_MODULE(MatrixGenerator)
 {
     using namespace boost::python;
-    def("generate_entry", generate_entry_rectangle_matrices);
-    def("generate_entry_rectangle_matrices", generate_entry_rectangle_matrices);
-    def("generate_entry_square_matrices", generate_entry_square_matrices);
-    def("generate_entry_inner_product", generate_entry_inner_product);
-    def("generate_entry_outer_product", generate_entry_outer_product);
-    def("generate_entry_extreme_cases", generate_entry_extreme_cases);
+    def("generate_entry", generate_entry_rectangle_matrices, generate_entry_rectangle_matrices_overloads());
+    def("generate_entry_rectangle_matrices", generate_entry_rectangle_matrices, generate_entry_rectangle_matrices_overloads());
+    def("generate_entry_square_matrices", generate_entry_square_matrices, generate_entry_square_matrices_overloads());
+    def("generate_entry_inner_product", generate_entry_inner_product, generate_entry_inner_product_overloads());
+    def("generate_entry_outer_product", generate_entry_outer_product, generate_entry_outer_product_overloads());
+    def("generate_entry_extreme_cases", generate_entry_extreme_cases, generate_entry_extreme_cases_overloads());
+    def("generate_entry_rmat", generate_entry_rmat, generate_entry_rmat_overloads());
+    def("generate_entry_banded", generate_entry_banded, generate_entry_banded_overloads());
+    def("generate_entry_block_diagonal", generate_entry_block_diagonal, generate_entry_block_diagonal_overloads());
+    def("generate_entry_stencil", generate_entry_stencil);
+    def("generate_entries_rectangle_matrices", generate_entries_rectangle_matrices, generate_entries_rectangle_matrices_overloads());
+    def("generate_entries_square_matrices", generate_entries_square_matrices, generate_entries_square_matrices_overloads());
+    def("read_matrix_market", read_matrix_market_indices, read_matrix_market_indices_overloads());
+    def("read_binary_matrix", read_binary_matrix_indices);
+    def("set_symbolic_product", set_symbolic_product);
+    def("set_product_kernel", set_product_kernel);
+    def("set_product_threads", set_product_threads);
+    def("set_product_log", set_product_log);
+    def("set_generator_threads", set_generator_threads);
+    def("set_matrix_format", set_matrix_format);
+    def("set_shard", set_shard);
 }
@@ -0,0 +1,59 @@
+#include "Parallel.h"
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+int default_thread_count()
+{
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+int parallel_thread_count(int64_t count, int64_t grain, int num_threads)
+{
+    if (num_threads <= 0)
+    {
+        num_threads = default_thread_count();
+    }
+    grain = std::max(grain, int64_t(1));
+    int64_t chunks = (count + grain - 1) / grain;
+    return static_cast<int>(std::max(int64_t(1), std::min(static_cast<int64_t>(num_threads), chunks)));
+}
+
+void parallel_for(int64_t count, int64_t grain, int num_threads, const std::function<void(int64_t, int64_t, int)> &body)
+{
+    if (count <= 0)
+    {
+        return;
+    }
+
+    grain = std::max(grain, int64_t(1));
+    int thread_count = parallel_thread_count(count, grain, num_threads);
+    if (thread_count == 1)
+    {
+        body(0, count, 0);
+        return;
+    }
+
+    std::atomic<int64_t> next(0);
+    auto worker = [&](int thread_index)
+    {
+        for (int64_t begin = next.fetch_add(grain); begin < count; begin = next.fetch_add(grain))
+        {
+            body(begin, std::min(begin + grain, count), thread_index);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(thread_count - 1);
+    for (int t = 1; t < thread_count; t++)
+    {
+        threads.emplace_back(worker, t);
+    }
+    worker(0);
+
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+}
@@ -0,0 +1,20 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <cstdint>
+#include <functional>
+
+// Number of threads used when a caller asks for 0 threads.
+int default_thread_count();
+
+// Splits [0, count) into chunks of at most grain items that worker threads claim dynamically.
+// body(begin, end, thread_index) gets a thread_index below the number of threads actually started,
+// so callers can keep per-thread scratch buffers indexed by it.
+// Threads are started per call rather than kept in a pool, so the module stays safe to use from
+// forked worker processes.
+void parallel_for(int64_t count, int64_t grain, int num_threads, const std::function<void(int64_t, int64_t, int)> &body);
+
+// Number of threads parallel_for will start for the given arguments.
+int parallel_thread_count(int64_t count, int64_t grain, int num_threads);
+
+#endif // PARALLEL_H
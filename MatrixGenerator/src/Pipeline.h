@@ -0,0 +1,246 @@
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "Parallel.h"
+
+// FIFO of at most capacity items shared between threads. push blocks while the queue is full and pop
+// while it is empty; once closed, push refuses new items and pop drains the rest before failing.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(std::max<size_t>(1, capacity)) {}
+
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_full.wait(lock, [&]() { return closed || items.size() < capacity; });
+        if (closed)
+        {
+            return false;
+        }
+        items.push_back(std::move(item));
+        not_empty.notify_one();
+        return true;
+    }
+
+    bool pop(T &item)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        not_empty.wait(lock, [&]() { return closed || !items.empty(); });
+        if (items.empty())
+        {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        not_full.notify_one();
+        return true;
+    }
+
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        not_full.notify_all();
+        not_empty.notify_all();
+    }
+
+private:
+    size_t capacity;
+    std::deque<T> items;
+    bool closed = false;
+    std::mutex mutex;
+    std::condition_variable not_full, not_empty;
+};
+
+// Where the threads of one stage spent their time: running the stage, waiting for input from the previous
+// queue and waiting for room in the next one
+struct StageStatistics
+{
+    int threads = 0;
+    double busy_seconds = 0, starved_seconds = 0, blocked_seconds = 0;
+
+    // Share of the stage's thread time spent running it
+    double utilization(double wall_seconds) const
+    {
+        return threads > 0 && wall_seconds > 0 ? busy_seconds / (threads * wall_seconds) : 0.0;
+    }
+};
+
+struct PipelineStatistics
+{
+    double wall_seconds = 0;
+    StageStatistics produce, transform, consume;
+};
+
+// Runs the items 0 .. count - 1 through produce(index) -> A, transform(A) -> B and consume(B), each stage
+// on its own threads (0 uses every hardware thread) joined by queues of capacity items. A full queue holds
+// back the stage before it, so at most the stage threads plus 2 * capacity items are in flight. Threads are
+// started per call, like parallel_for. The first exception a stage throws closes both queues, stops every
+// stage and is rethrown once all threads have joined.
+template <typename A, typename B>
+PipelineStatistics run_pipeline(int64_t count, int produce_threads, int transform_threads, int consume_threads, size_t capacity,
+                                const std::function<A(int64_t)> &produce, const std::function<B(A &)> &transform, const std::function<void(B &)> &consume)
+{
+    using clock = std::chrono::steady_clock;
+    auto seconds_since = [](clock::time_point start) { return std::chrono::duration<double>(clock::now() - start).count(); };
+
+    PipelineStatistics statistics;
+    statistics.produce.threads = produce_threads > 0 ? produce_threads : default_thread_count();
+    statistics.transform.threads = transform_threads > 0 ? transform_threads : default_thread_count();
+    statistics.consume.threads = consume_threads > 0 ? consume_threads : default_thread_count();
+
+    BoundedQueue<A> produced(capacity);
+    BoundedQueue<B> transformed(capacity);
+    std::atomic<int64_t> next(0);
+    std::atomic<int> producing(statistics.produce.threads), transforming(statistics.transform.threads);
+    std::mutex statistics_mutex;
+
+    std::exception_ptr error;
+    std::atomic<bool> failed(false);
+    std::mutex error_mutex;
+
+    // Keeps the first exception and wakes every thread waiting on a queue so that all of them exit
+    auto fail = [&]()
+    {
+        {
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+        }
+        failed = true;
+        produced.close();
+        transformed.close();
+    };
+
+    // Each thread sums its own times and adds them to its stage when it finishes
+    auto add_times = [&](StageStatistics &stage, double busy, double starved, double blocked)
+    {
+        std::lock_guard<std::mutex> lock(statistics_mutex);
+        stage.busy_seconds += busy;
+        stage.starved_seconds += starved;
+        stage.blocked_seconds += blocked;
+    };
+
+    auto producer = [&]()
+    {
+        double busy = 0, blocked = 0;
+        try
+        {
+            for (int64_t index = next++; index < count && !failed; index = next++)
+            {
+                auto start = clock::now();
+                A item = produce(index);
+                busy += seconds_since(start);
+
+                start = clock::now();
+                produced.push(std::move(item));
+                blocked += seconds_since(start);
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        add_times(statistics.produce, busy, 0, blocked);
+        if (--producing == 0)
+        {
+            produced.close();
+        }
+    };
+
+    auto transformer = [&]()
+    {
+        double busy = 0, starved = 0, blocked = 0;
+        try
+        {
+            A item;
+            for (auto start = clock::now(); !failed && produced.pop(item); start = clock::now())
+            {
+                starved += seconds_since(start);
+
+                start = clock::now();
+                B result = transform(item);
+                busy += seconds_since(start);
+
+                start = clock::now();
+                transformed.push(std::move(result));
+                blocked += seconds_since(start);
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        add_times(statistics.transform, busy, starved, blocked);
+        if (--transforming == 0)
+        {
+            transformed.close();
+        }
+    };
+
+    auto consumer = [&]()
+    {
+        double busy = 0, starved = 0;
+        try
+        {
+            B item;
+            for (auto start = clock::now(); !failed && transformed.pop(item); start = clock::now())
+            {
+                starved += seconds_since(start);
+
+                start = clock::now();
+                consume(item);
+                busy += seconds_since(start);
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        add_times(statistics.consume, busy, starved, 0);
+    };
+
+    const auto start = clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < statistics.produce.threads; t++)
+    {
+        threads.emplace_back(producer);
+    }
+    for (int t = 0; t < statistics.transform.threads; t++)
+    {
+        threads.emplace_back(transformer);
+    }
+    for (int t = 0; t < statistics.consume.threads; t++)
+    {
+        threads.emplace_back(consumer);
+    }
+    for (auto &thread : threads)
+    {
+        thread.join();
+    }
+    statistics.wall_seconds = seconds_since(start);
+
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    return statistics;
+}
+
+#endif // PIPELINE_H
@@ -0,0 +1,171 @@
+#include "Random.h"
+#include <random>
+
+// The AVX-512 and AVX2 paths are always compiled, each for its own target, and picked at run time, so
+// the module runs on any x86-64 CPU without being built for the host
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RANDOM_X86_DISPATCH
+#include <immintrin.h>
+#endif
+
+uint64_t resolve_seed(uint64_t seed)
+{
+    std::random_device rd;
+    while (seed == 0)
+    {
+        seed = static_cast<uint64_t>(rd()) << 32 | rd();
+    }
+    return seed;
+}
+
+// Counter of block b after counter, carrying into the high word of the block index
+static void offset_counter(const uint32_t counter[4], int64_t b, uint32_t out[4])
+{
+    uint64_t index = (static_cast<uint64_t>(counter[1]) << 32 | counter[0]) + b;
+    out[0] = static_cast<uint32_t>(index);
+    out[1] = static_cast<uint32_t>(index >> 32);
+    out[2] = counter[2];
+    out[3] = counter[3];
+}
+
+#ifdef RANDOM_X86_DISPATCH
+
+// 16 blocks per pass, one per 32-bit lane. _mm512_mul_epu32 multiplies the even lanes to 64 bits, so the
+// odd lanes are shifted down for a second multiply and the halves are blended back per lane.
+__attribute__((target("avx512f")))
+static int64_t generate_blocks_avx512(const uint32_t counter[4], const uint32_t key[2], int64_t count, uint32_t *out)
+{
+    const __m512i lanes = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+    const __m512i m0 = _mm512_set1_epi32(0xD2511F53), m1 = _mm512_set1_epi32(0xCD9E8D57);
+    const __mmask16 odd = 0xAAAA;
+
+    int64_t b = 0;
+    for (; b + 16 <= count && counter[0] <= UINT32_MAX - (b + 15); b += 16)
+    {
+        __m512i c0 = _mm512_add_epi32(_mm512_set1_epi32(counter[0] + static_cast<uint32_t>(b)), lanes);
+        __m512i c1 = _mm512_set1_epi32(counter[1]);
+        __m512i c2 = _mm512_set1_epi32(counter[2]);
+        __m512i c3 = _mm512_set1_epi32(counter[3]);
+        __m512i k0 = _mm512_set1_epi32(key[0]);
+        __m512i k1 = _mm512_set1_epi32(key[1]);
+
+        for (int round = 0; round < 10; round++)
+        {
+            __m512i even0 = _mm512_mul_epu32(c0, m0), odd0 = _mm512_mul_epu32(_mm512_srli_epi64(c0, 32), m0);
+            __m512i even1 = _mm512_mul_epu32(c2, m1), odd1 = _mm512_mul_epu32(_mm512_srli_epi64(c2, 32), m1);
+            __m512i hi0 = _mm512_mask_blend_epi32(odd, _mm512_srli_epi64(even0, 32), odd0);
+            __m512i lo0 = _mm512_mask_blend_epi32(odd, even0, _mm512_slli_epi64(odd0, 32));
+            __m512i hi1 = _mm512_mask_blend_epi32(odd, _mm512_srli_epi64(even1, 32), odd1);
+            __m512i lo1 = _mm512_mask_blend_epi32(odd, even1, _mm512_slli_epi64(odd1, 32));
+
+            c0 = _mm512_xor_si512(_mm512_xor_si512(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm512_xor_si512(_mm512_xor_si512(hi0, c3), k1);
+            c3 = lo0;
+            k0 = _mm512_add_epi32(k0, _mm512_set1_epi32(0x9E3779B9));
+            k1 = _mm512_add_epi32(k1, _mm512_set1_epi32(0xBB67AE85));
+        }
+
+        alignas(64) uint32_t words[4][16];
+        _mm512_store_si512(words[0], c0);
+        _mm512_store_si512(words[1], c1);
+        _mm512_store_si512(words[2], c2);
+        _mm512_store_si512(words[3], c3);
+        for (int lane = 0; lane < 16; lane++)
+        {
+            for (int w = 0; w < 4; w++)
+            {
+                out[4 * (b + lane) + w] = words[w][lane];
+            }
+        }
+    }
+    return b;
+}
+
+// 8 blocks per pass, one per 32-bit lane. _mm256_mul_epu32 multiplies the even lanes to 64 bits, so the
+// odd lanes are shifted down for a second multiply and the halves are blended back per lane.
+__attribute__((target("avx2")))
+static int64_t generate_blocks_avx2(const uint32_t counter[4], const uint32_t key[2], int64_t count, uint32_t *out)
+{
+    const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i m0 = _mm256_set1_epi32(0xD2511F53), m1 = _mm256_set1_epi32(0xCD9E8D57);
+
+    int64_t b = 0;
+    for (; b + 8 <= count && counter[0] <= UINT32_MAX - (b + 7); b += 8)
+    {
+        __m256i c0 = _mm256_add_epi32(_mm256_set1_epi32(counter[0] + static_cast<uint32_t>(b)), lanes);
+        __m256i c1 = _mm256_set1_epi32(counter[1]);
+        __m256i c2 = _mm256_set1_epi32(counter[2]);
+        __m256i c3 = _mm256_set1_epi32(counter[3]);
+        __m256i k0 = _mm256_set1_epi32(key[0]);
+        __m256i k1 = _mm256_set1_epi32(key[1]);
+
+        for (int round = 0; round < 10; round++)
+        {
+            __m256i even0 = _mm256_mul_epu32(c0, m0), odd0 = _mm256_mul_epu32(_mm256_srli_epi64(c0, 32), m0);
+            __m256i even1 = _mm256_mul_epu32(c2, m1), odd1 = _mm256_mul_epu32(_mm256_srli_epi64(c2, 32), m1);
+            __m256i hi0 = _mm256_blend_epi32(_mm256_srli_epi64(even0, 32), odd0, 0xAA);
+            __m256i lo0 = _mm256_blend_epi32(even0, _mm256_slli_epi64(odd0, 32), 0xAA);
+            __m256i hi1 = _mm256_blend_epi32(_mm256_srli_epi64(even1, 32), odd1, 0xAA);
+            __m256i lo1 = _mm256_blend_epi32(even1, _mm256_slli_epi64(odd1, 32), 0xAA);
+
+            c0 = _mm256_xor_si256(_mm256_xor_si256(hi1, c1), k0);
+            c1 = lo1;
+            c2 = _mm256_xor_si256(_mm256_xor_si256(hi0, c3), k1);
+            c3 = lo0;
+            k0 = _mm256_add_epi32(k0, _mm256_set1_epi32(0x9E3779B9));
+            k1 = _mm256_add_epi32(k1, _mm256_set1_epi32(0xBB67AE85));
+        }
+
+        alignas(32) uint32_t words[4][8];
+        _mm256_store_si256(reinterpret_cast<__m256i *>(words[0]), c0);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(words[1]), c1);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(words[2]), c2);
+        _mm256_store_si256(reinterpret_cast<__m256i *>(words[3]), c3);
+        for (int lane = 0; lane < 8; lane++)
+        {
+            for (int w = 0; w < 4; w++)
+            {
+                out[4 * (b + lane) + w] = words[w][lane];
+            }
+        }
+    }
+    return b;
+}
+
+#endif
+
+static int64_t generate_blocks_scalar(const uint32_t *, const uint32_t *, int64_t, uint32_t *)
+{
+    return 0;
+}
+
+// Blocks generated by the widest vector path the CPU has, leaving the rest to the caller
+static int64_t generate_blocks_vector(const uint32_t counter[4], const uint32_t key[2], int64_t count, uint32_t *out)
+{
+#ifdef RANDOM_X86_DISPATCH
+    static const auto kernel = []()
+    {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f"))
+        {
+            return generate_blocks_avx512;
+        }
+        return __builtin_cpu_supports("avx2") ? generate_blocks_avx2 : generate_blocks_scalar;
+    }();
+    return kernel(counter, key, count, out);
+#else
+    return generate_blocks_scalar(counter, key, count, out);
+#endif
+}
+
+void RandomEngine::generate_blocks(const uint32_t counter[4], const uint32_t key[2], int64_t count, uint32_t *out)
+{
+    // The vector path stops where the low counter word would wrap; the rest carries one block at a time
+    for (int64_t b = generate_blocks_vector(counter, key, count, out); b < count; b++)
+    {
+        uint32_t block_counter[4];
+        offset_counter(counter, b, block_counter);
+        generate_block(block_counter, key, out + 4 * b);
+    }
+}
@@ -0,0 +1,146 @@
+#ifndef RANDOM_H
+#define RANDOM_H
+
+#include <cstdint>
+#include <limits>
+
+// Philox4x32-10 counter-based generator (Salmon et al., "Parallel random numbers: as easy as 1, 2, 3").
+// Output block n of (seed, stream) is a pure function of those three values, so every stream is
+// independent and can be handed to a thread without shared state, and any position can be
+// reproduced from (seed, stream) alone. Satisfies UniformRandomBitGenerator for <random>.
+// A substream splits a stream further for parallel work: it fills the high half of the block index,
+// leaving each substream 2^32 blocks (2^33 outputs).
+class RandomEngine
+{
+public:
+    using result_type = uint64_t;
+
+    RandomEngine(uint64_t seed, uint64_t stream, uint32_t substream = 0)
+        : key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)},
+          counter{0, substream, static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)}
+    {
+    }
+
+    static constexpr result_type min() { return 0; }
+    static constexpr result_type max() { return std::numeric_limits<result_type>::max(); }
+
+    result_type operator()()
+    {
+        if (position == buffer_words)
+        {
+            refill();
+        }
+        result_type value = static_cast<result_type>(buffer[position]) | static_cast<result_type>(buffer[position + 1]) << 32;
+        position += 2;
+        return value;
+    }
+
+    // Writes the next n outputs, the values n calls would return
+    void fill(uint64_t *out, int64_t n)
+    {
+        for (int64_t i = 0; i < n; i++)
+        {
+            out[i] = (*this)();
+        }
+    }
+
+    // Skips n outputs
+    void discard(uint64_t n)
+    {
+        uint64_t buffered = (buffer_words - position) / 2;
+        if (n <= buffered)
+        {
+            position += static_cast<int>(2 * n);
+            return;
+        }
+        n -= buffered;
+        advance_counter(n / 2);
+        position = buffer_words;
+        if (n % 2)
+        {
+            (*this)();
+        }
+    }
+
+    // The ten Philox rounds over one 128-bit counter block
+    static void generate_block(const uint32_t counter[4], const uint32_t key[2], uint32_t out[4])
+    {
+        uint32_t c0 = counter[0], c1 = counter[1], c2 = counter[2], c3 = counter[3];
+        uint32_t k0 = key[0], k1 = key[1];
+        for (int round = 0; round < 10; round++)
+        {
+            uint64_t product0 = static_cast<uint64_t>(0xD2511F53u) * c0;
+            uint64_t product1 = static_cast<uint64_t>(0xCD9E8D57u) * c2;
+            uint32_t next0 = static_cast<uint32_t>(product1 >> 32) ^ c1 ^ k0;
+            uint32_t next2 = static_cast<uint32_t>(product0 >> 32) ^ c3 ^ k1;
+            c1 = static_cast<uint32_t>(product1);
+            c3 = static_cast<uint32_t>(product0);
+            c0 = next0;
+            c2 = next2;
+            k0 += 0x9E3779B9u;
+            k1 += 0xBB67AE85u;
+        }
+        out[0] = c0;
+        out[1] = c1;
+        out[2] = c2;
+        out[3] = c3;
+    }
+
+    // Blocks for the counts consecutive counters from counter, written back to back to out. Runs the
+    // rounds across AVX-512 or AVX2 lanes when the CPU has them, with the same output as
+    // generate_block.
+    static void generate_blocks(const uint32_t counter[4], const uint32_t key[2], int64_t count, uint32_t *out);
+
+private:
+    // Blocks generated per refill, enough to fill the widest vector path once
+    static constexpr int buffer_blocks = 16;
+    static constexpr int buffer_words = 4 * buffer_blocks;
+
+    void refill()
+    {
+        generate_blocks(counter, key, buffer_blocks, buffer);
+        advance_counter(buffer_blocks);
+        position = 0;
+    }
+
+    void advance_counter(uint64_t blocks)
+    {
+        uint64_t index = (static_cast<uint64_t>(counter[1]) << 32 | counter[0]) + blocks;
+        counter[0] = static_cast<uint32_t>(index);
+        counter[1] = static_cast<uint32_t>(index >> 32);
+    }
+
+    uint32_t key[2];
+    uint32_t counter[4];
+    uint32_t buffer[buffer_words];
+    int position = buffer_words;
+};
+
+// Uniform integer in [0, n) for n > 0: Lemire's multiply-shift, rejecting only the few low products that
+// would bias it, so the common case needs neither a division nor a second draw
+inline uint64_t uniform_below(RandomEngine &gen, uint64_t n)
+{
+    unsigned __int128 product = static_cast<unsigned __int128>(gen()) * n;
+    uint64_t low = static_cast<uint64_t>(product);
+    if (low < n)
+    {
+        const uint64_t threshold = -n % n;
+        while (low < threshold)
+        {
+            product = static_cast<unsigned __int128>(gen()) * n;
+            low = static_cast<uint64_t>(product);
+        }
+    }
+    return static_cast<uint64_t>(product >> 64);
+}
+
+// seed itself, or a fresh seed from std::random_device when seed is 0
+uint64_t resolve_seed(uint64_t seed);
+
+// Sub-stream k (0 to 3) of a caller's stream, used to give the parts of one entry their own streams
+inline uint64_t sub_stream(uint64_t stream, uint64_t k)
+{
+    return stream * 4 + k;
+}
+
+#endif // RANDOM_H
@@ -0,0 +1,210 @@
+#include "Shard.h"
+#include <cstring>
+#include <iostream>
+
+static const char shard_magic[8] = {'S', 'P', 'M', 'D', 'S', 'H', 'D', '1'};
+static const char shard_entry_magic[8] = {'S', 'P', 'M', 'D', 'E', 'N', 'T', '1'};
+
+ShardWriter::~ShardWriter()
+{
+    close();
+}
+
+bool ShardWriter::open(std::filesystem::path path)
+{
+    close();
+
+    file.open(path, std::ios::binary | std::ios::trunc);
+    if (!file.is_open())
+    {
+        std::cerr << "Failed to create shard " << path << std::endl;
+        return false;
+    }
+
+    // The header is rewritten on close, until then it announces no index
+    ShardHeader header = {};
+    std::memcpy(header.magic, shard_magic, sizeof(header.magic));
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.flush();
+
+    shard_path = path;
+    offsets.clear();
+    position = sizeof(header);
+    return static_cast<bool>(file);
+}
+
+int64_t ShardWriter::append(const DataSetEntry &entry, bool save_product, uint64_t seed, uint64_t stream)
+{
+    if (!file.is_open())
+    {
+        return -1;
+    }
+
+    ShardEntryMetadata metadata = {};
+    std::memcpy(metadata.magic, shard_entry_magic, sizeof(metadata.magic));
+    metadata.m1_rows = entry.m1.rows();
+    metadata.m1_cols = entry.m1.cols();
+    metadata.m1_nnz = entry.m1.nonZeros();
+    metadata.m2_rows = entry.m2.rows();
+    metadata.m2_cols = entry.m2.cols();
+    metadata.m2_nnz = entry.m2.nonZeros();
+    metadata.product_rows = entry.prod.rows();
+    metadata.product_cols = entry.prod.cols();
+    metadata.product_nnz = entry.product_nnz;
+    metadata.product_flops = entry.product_flops;
+    metadata.m1_nnz_density = entry.m1_nnz_density;
+    metadata.m2_nnz_density = entry.m2_nnz_density;
+    metadata.product_nnz_density = entry.product_nnz_density;
+    metadata.product_compression_ratio = entry.product_compression_ratio;
+    metadata.seed = seed;
+    metadata.stream = stream;
+
+    // The metadata row goes first with its offsets unknown and is patched once the matrices are out
+    const uint64_t start = position;
+    const uint64_t metadata_size = align_offset(sizeof(metadata));
+    const char padding[64] = {};
+    file.write(reinterpret_cast<const char *>(&metadata), sizeof(metadata));
+    file.write(padding, metadata_size - sizeof(metadata));
+
+    uint64_t size = metadata_size;
+    metadata.m1_offset = size;
+    size += write_binary_matrix(file, entry.m1);
+    metadata.m2_offset = size;
+    size += write_binary_matrix(file, entry.m2);
+    if (save_product)
+    {
+        metadata.product_offset = size;
+        size += write_binary_matrix(file, entry.prod);
+    }
+    metadata.record_size = size;
+
+    file.seekp(start);
+    file.write(reinterpret_cast<const char *>(&metadata), sizeof(metadata));
+    file.seekp(start + size);
+    file.flush();
+    if (!file)
+    {
+        std::cerr << "Failed to append to shard " << shard_path << std::endl;
+        return -1;
+    }
+
+    position = start + size;
+    offsets.push_back(start);
+    return static_cast<int64_t>(offsets.size()) - 1;
+}
+
+bool ShardWriter::close()
+{
+    if (!file.is_open())
+    {
+        return true;
+    }
+
+    ShardHeader header = {};
+    std::memcpy(header.magic, shard_magic, sizeof(header.magic));
+    header.entries = offsets.size();
+    header.index_offset = position;
+    file.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+    file.seekp(0);
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    file.close();
+
+    bool written = !file.fail();
+    if (!written)
+    {
+        std::cerr << "Failed to write the index of shard " << shard_path << std::endl;
+    }
+    offsets.clear();
+    return written;
+}
+
+bool ShardReader::open(std::filesystem::path path)
+{
+    close();
+    if (!file.open(path))
+    {
+        return false;
+    }
+
+    const char *data = file.data();
+    const uint64_t size = file.size();
+    const ShardHeader *header = reinterpret_cast<const ShardHeader *>(data);
+    if (size < sizeof(ShardHeader) || std::memcmp(header->magic, shard_magic, sizeof(header->magic)) != 0)
+    {
+        std::cerr << path << " is not a shard" << std::endl;
+        close();
+        return false;
+    }
+
+    if (header->index_offset != 0)
+    {
+        if (header->index_offset > size || header->entries > (size - header->index_offset) / sizeof(uint64_t))
+        {
+            std::cerr << "The index of shard " << path << " runs past its end" << std::endl;
+            close();
+            return false;
+        }
+        const uint64_t *index = reinterpret_cast<const uint64_t *>(data + header->index_offset);
+        offsets.assign(index, index + header->entries);
+        return true;
+    }
+
+    // Unclosed shard: walk the records up to the first incomplete one
+    for (uint64_t offset = sizeof(ShardHeader); offset + sizeof(ShardEntryMetadata) <= size;)
+    {
+        const ShardEntryMetadata *metadata = reinterpret_cast<const ShardEntryMetadata *>(data + offset);
+        if (std::memcmp(metadata->magic, shard_entry_magic, sizeof(metadata->magic)) != 0
+            || metadata->record_size < sizeof(ShardEntryMetadata) || metadata->record_size > size - offset)
+        {
+            break;
+        }
+        offsets.push_back(offset);
+        offset += metadata->record_size;
+    }
+    return true;
+}
+
+void ShardReader::close()
+{
+    file.close();
+    offsets.clear();
+}
+
+const ShardEntryMetadata *ShardReader::metadata(int64_t id) const
+{
+    if (id < 0 || id >= size() || offsets[id] > file.size() || file.size() - offsets[id] < sizeof(ShardEntryMetadata))
+    {
+        return nullptr;
+    }
+    const ShardEntryMetadata *row = reinterpret_cast<const ShardEntryMetadata *>(file.data() + offsets[id]);
+    return std::memcmp(row->magic, shard_entry_magic, sizeof(row->magic)) == 0 ? row : nullptr;
+}
+
+const char *ShardReader::record(int64_t id, ShardMatrix which) const
+{
+    const ShardEntryMetadata *row = metadata(id);
+    if (row == nullptr)
+    {
+        return nullptr;
+    }
+
+    const uint64_t offset = which == ShardMatrix::M1 ? row->m1_offset : which == ShardMatrix::M2 ? row->m2_offset : row->product_offset;
+    const uint64_t available = std::min<uint64_t>(row->record_size, file.size() - offsets[id]);
+    if (offset == 0 || offset >= available)
+    {
+        return nullptr;
+    }
+
+    const char *matrix_record = file.data() + offsets[id] + offset;
+    if (!binary_matrix_valid(matrix_record, available - offset))
+    {
+        std::cerr << "Entry " << id << " of the shard holds an invalid matrix" << std::endl;
+        return nullptr;
+    }
+    return matrix_record;
+}
+
+Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> ShardReader::matrix(int64_t id, ShardMatrix which) const
+{
+    return binary_matrix_map(record(id, which));
+}
@@ -0,0 +1,99 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <Eigen/SparseCore>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <vector>
+
+#include "MatrixGenerator.h"
+#include "Utilities.h"
+
+// A shard packs many dataset entries into one file: a ShardHeader, then one record per entry, then an
+// index of the record offsets. A record is a ShardEntryMetadata row followed by the entry's m1, m2 and
+// product matrices in the binary CSC layout of save_matrix_binary, everything on 64-byte boundaries.
+// The index is only written when the writer closes; a shard whose writer never closed is read by
+// walking its records instead.
+
+struct ShardHeader
+{
+    char magic[8];
+    uint64_t entries, index_offset;
+    char reserved[40];
+};
+
+static_assert(sizeof(ShardHeader) == 64, "ShardHeader must fill one 64-byte line");
+
+struct ShardEntryMetadata
+{
+    char magic[8];
+    // Bytes from this row to the next record
+    uint64_t record_size;
+    int64_t m1_rows, m1_cols, m1_nnz;
+    int64_t m2_rows, m2_cols, m2_nnz;
+    int64_t product_rows, product_cols, product_nnz, product_flops;
+    float m1_nnz_density, m2_nnz_density, product_nnz_density, product_compression_ratio;
+    uint64_t seed, stream;
+    // Offsets of the matrices from this row, 0 for a product that was not saved
+    uint64_t m1_offset, m2_offset, product_offset;
+};
+
+enum class ShardMatrix
+{
+    M1,
+    M2,
+    Product
+};
+
+class ShardWriter
+{
+public:
+    ~ShardWriter();
+
+    // Creates or truncates the shard, returns false on failure
+    bool open(std::filesystem::path path);
+
+    // Appends the entry and flushes it, so a shard left unclosed still holds every appended entry.
+    // Returns the entry id within the shard, or -1 on failure.
+    int64_t append(const DataSetEntry &entry, bool save_product, uint64_t seed, uint64_t stream);
+
+    // Writes the index and the header, returns false on failure
+    bool close();
+
+    bool is_open() const { return file.is_open(); }
+    const std::filesystem::path &path() const { return shard_path; }
+
+private:
+    std::ofstream file;
+    std::filesystem::path shard_path;
+    std::vector<uint64_t> offsets;
+    uint64_t position = 0;
+};
+
+// Random access to the entries of a mapped shard by id, without copying their matrices
+class ShardReader
+{
+public:
+    // Maps the shard and loads its index, returns false on failure
+    bool open(std::filesystem::path path);
+    void close();
+
+    int64_t size() const { return static_cast<int64_t>(offsets.size()); }
+
+    // Metadata row of entry id, nullptr when id is out of range
+    const ShardEntryMetadata *metadata(int64_t id) const;
+
+    // Binary matrix record of entry id, checked with binary_matrix_valid, or nullptr when id is out of
+    // range, the matrix was not saved or it is malformed
+    const char *record(int64_t id, ShardMatrix which) const;
+
+    // Matrix of entry id, empty when record() has none
+    Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> matrix(int64_t id, ShardMatrix which) const;
+
+private:
+    MappedFile file;
+    std::vector<uint64_t> offsets;
+};
+
+#endif // SHARD_H
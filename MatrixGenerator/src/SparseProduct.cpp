@@ -0,0 +1,1101 @@
+#include "SparseProduct.h"
+#include <algorithm>
+#include <memory>
+#include <numeric>
+#include <vector>
+
+#include "Bitset.h"
+#include "Parallel.h"
+
+// Raw CSC arrays of both factors, shared by the accumulators
+struct ProductOperands
+{
+    const int64_t *lhs_outer, *lhs_inner, *rhs_outer, *rhs_inner;
+    int64_t rows, cols;
+    int64_t operand_nnz;
+
+    ProductOperands(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs)
+        : lhs_outer(lhs.outerIndexPtr()), lhs_inner(lhs.innerIndexPtr()),
+          rhs_outer(rhs.outerIndexPtr()), rhs_inner(rhs.innerIndexPtr()),
+          rows(lhs.rows()), cols(rhs.cols()), operand_nnz(lhs.nonZeros() + rhs.nonZeros())
+    {
+        eigen_assert(lhs.cols() == rhs.rows());
+        eigen_assert(lhs.isCompressed() && rhs.isCompressed());
+    }
+
+    // Upper bound of the nonzeros of output column j: the flops spent on it
+    int64_t column_flops(int64_t j) const
+    {
+        int64_t flops = 0;
+        for (int64_t p = rhs_outer[j]; p < rhs_outer[j + 1]; p++)
+        {
+            int64_t k = rhs_inner[p];
+            flops += lhs_outer[k + 1] - lhs_outer[k];
+        }
+        return flops;
+    }
+
+    // Calls visit(i) for every lhs row hit while forming output column j, duplicates included
+    template <typename Visitor>
+    void for_each_row(int64_t j, Visitor &&visit) const
+    {
+        for (int64_t p = rhs_outer[j]; p < rhs_outer[j + 1]; p++)
+        {
+            int64_t k = rhs_inner[p];
+            for (int64_t q = lhs_outer[k]; q < lhs_outer[k + 1]; q++)
+            {
+                visit(lhs_inner[q]);
+            }
+        }
+    }
+};
+
+// Dense marker accumulator: marker[i] holds the last output column that touched row i,
+// so it never needs clearing between columns.
+struct MarkerAccumulator
+{
+    using Operands = ProductOperands;
+
+    const ProductOperands &operands;
+    std::vector<int64_t> marker;
+
+    explicit MarkerAccumulator(const ProductOperands &operands) : operands(operands), marker(operands.rows, -1) {}
+
+    int64_t count(int64_t j)
+    {
+        int64_t nnz = 0;
+        operands.for_each_row(j, [&](int64_t i)
+        {
+            if (marker[i] != j)
+            {
+                marker[i] = j;
+                nnz++;
+            }
+        });
+        return nnz;
+    }
+
+    void fill(int64_t j, int64_t *out, int64_t nnz)
+    {
+        int64_t *it = out;
+        operands.for_each_row(j, [&](int64_t i)
+        {
+            if (marker[i] != j)
+            {
+                marker[i] = j;
+                *it++ = i;
+            }
+        });
+
+        // Dense columns are emitted in order by scanning the marker, sparse ones are sorted in place
+        if (nnz * 16 > operands.rows)
+        {
+            it = out;
+            for (int64_t i = 0; i < operands.rows; i++)
+            {
+                if (marker[i] == j)
+                {
+                    *it++ = i;
+                }
+            }
+        }
+        else
+        {
+            std::sort(out, out + nnz);
+        }
+    }
+};
+
+// Bitmap accumulator: rows are OR-ed into a bitset of the output column and counted with
+// popcount. Only the words a column touched are cleared afterwards, unless most of the
+// bitmap was touched, in which case a vectorized pass over the whole bitmap is cheaper.
+struct BitmapAccumulator
+{
+    using Operands = ProductOperands;
+
+    const ProductOperands &operands;
+    std::vector<uint64_t> words;
+    std::vector<int64_t> touched;
+
+    explicit BitmapAccumulator(const ProductOperands &operands) : operands(operands), words(bitset_words(operands.rows), 0) {}
+
+    void accumulate(int64_t j)
+    {
+        touched.clear();
+        operands.for_each_row(j, [&](int64_t i)
+        {
+            uint64_t &word = words[i >> 6];
+            if (word == 0)
+            {
+                touched.push_back(i >> 6);
+            }
+            word |= uint64_t(1) << (i & 63);
+        });
+    }
+
+    bool mostly_touched() const
+    {
+        return touched.size() * 4 > words.size();
+    }
+
+    int64_t count(int64_t j)
+    {
+        accumulate(j);
+
+        int64_t nnz = 0;
+        if (mostly_touched())
+        {
+            nnz = popcount_words(words.data(), words.size());
+            std::fill(words.begin(), words.end(), 0);
+        }
+        else
+        {
+            for (int64_t w : touched)
+            {
+                nnz += __builtin_popcountll(words[w]);
+                words[w] = 0;
+            }
+        }
+        return nnz;
+    }
+
+    void fill(int64_t j, int64_t *out, int64_t)
+    {
+        accumulate(j);
+
+        // Emitting set bits word by word in increasing word order yields sorted rows
+        // without sorting the entries themselves
+        auto emit = [&](int64_t w)
+        {
+            for (uint64_t bits = words[w]; bits; bits &= bits - 1)
+            {
+                *out++ = (w << 6) + __builtin_ctzll(bits);
+            }
+            words[w] = 0;
+        };
+
+        if (mostly_touched())
+        {
+            for (int64_t w = 0; w < static_cast<int64_t>(words.size()); w++)
+            {
+                emit(w);
+            }
+        }
+        else
+        {
+            std::sort(touched.begin(), touched.end());
+            for (int64_t w : touched)
+            {
+                emit(w);
+            }
+        }
+    }
+};
+
+// Open-addressing hash accumulator with linear probing. The table is sized per column from the
+// column's flop count, so its footprint follows the output column rather than the row dimension.
+struct HashAccumulator
+{
+    using Operands = ProductOperands;
+
+    static constexpr int64_t empty = -1;
+
+    const ProductOperands &operands;
+    std::vector<int64_t> table;
+    int64_t mask = 0;
+    int shift = 64;
+
+    explicit HashAccumulator(const ProductOperands &operands) : operands(operands) {}
+
+    // Clears a table of at least twice the column's flops, keeping the load factor at or below one half
+    void reset(int64_t flops)
+    {
+        int64_t capacity = 16;
+        shift = 60;
+        while (capacity < 2 * flops)
+        {
+            capacity <<= 1;
+            shift--;
+        }
+        if (static_cast<int64_t>(table.size()) < capacity)
+        {
+            table.resize(capacity);
+        }
+        mask = capacity - 1;
+        std::fill_n(table.begin(), capacity, empty);
+    }
+
+    // Returns true when row i was not in the table yet
+    bool insert(int64_t i)
+    {
+        int64_t slot = static_cast<int64_t>((static_cast<uint64_t>(i) * 0x9E3779B97F4A7C15ull) >> shift);
+        while (true)
+        {
+            if (table[slot] == i)
+            {
+                return false;
+            }
+            if (table[slot] == empty)
+            {
+                table[slot] = i;
+                return true;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    int64_t count(int64_t j)
+    {
+        int64_t flops = operands.column_flops(j);
+        if (flops == 0)
+        {
+            return 0;
+        }
+
+        reset(flops);
+        int64_t nnz = 0;
+        operands.for_each_row(j, [&](int64_t i)
+        {
+            nnz += insert(i);
+        });
+        return nnz;
+    }
+
+    void fill(int64_t j, int64_t *out, int64_t nnz)
+    {
+        reset(operands.column_flops(j));
+        int64_t *it = out;
+        operands.for_each_row(j, [&](int64_t i)
+        {
+            if (insert(i))
+            {
+                *it++ = i;
+            }
+        });
+        std::sort(out, out + nnz);
+    }
+};
+
+// Factors plus lhs packed as a dense bit matrix, one bitset of lhs.rows() bits per column
+struct BitMatrixOperands : ProductOperands
+{
+    int64_t col_words;
+    std::vector<uint64_t> lhs_bits;
+
+    BitMatrixOperands(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+        : ProductOperands(lhs, rhs), col_words(bitset_words(lhs.rows())), lhs_bits(lhs.cols() * col_words, 0)
+    {
+        parallel_for(lhs.cols(), 256, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            for (int64_t k = begin; k < end; k++)
+            {
+                for (int64_t q = lhs_outer[k]; q < lhs_outer[k + 1]; q++)
+                {
+                    bitset_set(lhs_bits.data() + k * col_words, lhs_inner[q]);
+                }
+            }
+        });
+    }
+};
+
+// Dense bit-matrix multiply: an output column is the OR of whole lhs column bitsets, word by word,
+// so the work per rhs nonzero is rows / 64 vectorizable words instead of one scattered update per lhs nonzero.
+struct DenseBitAccumulator
+{
+    using Operands = BitMatrixOperands;
+
+    const BitMatrixOperands &operands;
+    std::vector<uint64_t> words;
+
+    explicit DenseBitAccumulator(const BitMatrixOperands &operands) : operands(operands), words(operands.col_words) {}
+
+    void accumulate(int64_t j)
+    {
+        std::fill(words.begin(), words.end(), 0);
+        uint64_t *out = words.data();
+        const int64_t col_words = operands.col_words;
+        for (int64_t p = operands.rhs_outer[j]; p < operands.rhs_outer[j + 1]; p++)
+        {
+            const uint64_t *column = operands.lhs_bits.data() + operands.rhs_inner[p] * col_words;
+            for (int64_t w = 0; w < col_words; w++)
+            {
+                out[w] |= column[w];
+            }
+        }
+    }
+
+    int64_t count(int64_t j)
+    {
+        if (operands.rhs_outer[j + 1] == operands.rhs_outer[j])
+        {
+            return 0;
+        }
+        accumulate(j);
+        return popcount_words(words.data(), words.size());
+    }
+
+    void fill(int64_t j, int64_t *out, int64_t)
+    {
+        accumulate(j);
+        for (int64_t w = 0; w < static_cast<int64_t>(words.size()); w++)
+        {
+            for (uint64_t bits = words[w]; bits; bits &= bits - 1)
+            {
+                *out++ = (w << 6) + __builtin_ctzll(bits);
+            }
+        }
+    }
+};
+
+// Columns per chunk handed to a worker; small enough that a few heavy columns do not stall the others
+static int64_t column_grain(int64_t cols, int num_threads)
+{
+    int thread_count = parallel_thread_count(cols, 1, num_threads);
+    return std::max(int64_t(1), cols / (thread_count * 32));
+}
+
+// Runs fn(accumulator, begin, end) over column chunks with one lazily built accumulator per thread
+template <typename Accumulator, typename Fn>
+static void for_each_column_chunk(const typename Accumulator::Operands &operands, int num_threads, Fn &&fn)
+{
+    // Starting threads costs more than small products themselves
+    if (operands.operand_nnz < (1 << 15))
+    {
+        num_threads = 1;
+    }
+
+    int64_t grain = column_grain(operands.cols, num_threads);
+    std::vector<std::unique_ptr<Accumulator>> accumulators(parallel_thread_count(operands.cols, grain, num_threads));
+
+    parallel_for(operands.cols, grain, num_threads, [&](int64_t begin, int64_t end, int thread_index)
+    {
+        if (!accumulators[thread_index])
+        {
+            accumulators[thread_index] = std::make_unique<Accumulator>(operands);
+        }
+        fn(*accumulators[thread_index], begin, end);
+    });
+}
+
+template <typename Accumulator>
+static void count_columns(const typename Accumulator::Operands &operands, int64_t *col_nnz, int num_threads)
+{
+    for_each_column_chunk<Accumulator>(operands, num_threads, [&](Accumulator &accumulator, int64_t begin, int64_t end)
+    {
+        for (int64_t j = begin; j < end; j++)
+        {
+            col_nnz[j] = accumulator.count(j);
+        }
+    });
+}
+
+// Count pass sizes every column and the prefix sum places them, so the fill pass lets every
+// thread write its columns straight into the final CSC arrays without a global sort.
+template <typename Accumulator>
+static Eigen::SparseMatrix<bool, 0, int64_t> two_pass_product(const typename Accumulator::Operands &operands, int num_threads)
+{
+    Eigen::SparseMatrix<bool, 0, int64_t> result(operands.rows, operands.cols);
+    int64_t *outer = result.outerIndexPtr();
+
+    count_columns<Accumulator>(operands, outer + 1, num_threads);
+    outer[0] = 0;
+    std::partial_sum(outer + 1, outer + operands.cols + 1, outer + 1);
+
+    result.resizeNonZeros(outer[operands.cols]);
+    std::fill_n(result.valuePtr(), outer[operands.cols], true);
+    int64_t *inner = result.innerIndexPtr();
+
+    for_each_column_chunk<Accumulator>(operands, num_threads, [&](Accumulator &accumulator, int64_t begin, int64_t end)
+    {
+        for (int64_t j = begin; j < end; j++)
+        {
+            if (outer[j + 1] > outer[j])
+            {
+                accumulator.fill(j, inner + outer[j], outer[j + 1] - outer[j]);
+            }
+        }
+    });
+
+    return result;
+}
+
+// Parallel LSD radix sort of keys below 2^key_bits, 8 bits per pass. buffer is scratch of the same size.
+// Every block keeps its own digit histogram, so the scatter stays stable whichever thread runs a block.
+static void radix_sort(std::vector<uint64_t> &keys, std::vector<uint64_t> &buffer, int key_bits, int num_threads)
+{
+    const int64_t n = keys.size();
+    const int64_t block = std::max(int64_t(1 << 16), n / std::max(1, parallel_thread_count(n, 1, num_threads)));
+    const int64_t block_count = (n + block - 1) / block;
+    std::vector<int64_t> histograms(block_count * 256);
+
+    for (int shift = 0; shift < key_bits; shift += 8)
+    {
+        std::fill(histograms.begin(), histograms.end(), 0);
+        parallel_for(n, block, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            int64_t *histogram = histograms.data() + begin / block * 256;
+            for (int64_t i = begin; i < end; i++)
+            {
+                histogram[(keys[i] >> shift) & 0xff]++;
+            }
+        });
+
+        // Exclusive prefix sum in digit-major, block-minor order gives every block its scatter offsets
+        int64_t offset = 0;
+        for (int digit = 0; digit < 256; digit++)
+        {
+            for (int64_t b = 0; b < block_count; b++)
+            {
+                int64_t count = histograms[b * 256 + digit];
+                histograms[b * 256 + digit] = offset;
+                offset += count;
+            }
+        }
+
+        parallel_for(n, block, num_threads, [&](int64_t begin, int64_t end, int)
+        {
+            int64_t *histogram = histograms.data() + begin / block * 256;
+            for (int64_t i = begin; i < end; i++)
+            {
+                buffer[histogram[(keys[i] >> shift) & 0xff]++] = keys[i];
+            }
+        });
+        keys.swap(buffer);
+    }
+}
+
+// Row shared by every nonzero of matrix, -1 when they span several rows or there are none. Stops at the
+// first nonzero in another row.
+static int64_t single_row(const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
+{
+    const int64_t *inner = matrix.innerIndexPtr();
+    if (matrix.nonZeros() == 0 || std::any_of(inner, inner + matrix.nonZeros(), [&](int64_t i) { return i != inner[0]; }))
+    {
+        return -1;
+    }
+    return inner[0];
+}
+
+// Column holding every nonzero of matrix, -1 when they span several columns or there are none. The first
+// non-empty column is found by binary search on the outer index.
+static int64_t single_col(const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
+{
+    const int64_t *outer = matrix.outerIndexPtr();
+    if (matrix.nonZeros() == 0)
+    {
+        return -1;
+    }
+    const int64_t j = std::upper_bound(outer, outer + matrix.cols() + 1, int64_t(0)) - outer - 1;
+    return outer[j + 1] == matrix.nonZeros() ? j : -1;
+}
+
+// When lhs has nonzeros in a single row r and rhs in a single column c, the product is at most the
+// one entry (r, c), set exactly when the two index lists intersect. Returns -1 for any other shape,
+// otherwise the product's nnz (0 or 1) with row and col set to r and c. Only operands that fit a
+// 1 x k row times a k x 1 column (nnz(lhs) <= k >= nnz(rhs)) are probed.
+static int inner_product_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int64_t &row, int64_t &col)
+{
+    row = col = -1;
+    if (lhs.nonZeros() > lhs.cols() || rhs.nonZeros() > rhs.rows())
+    {
+        return -1;
+    }
+    row = single_row(lhs);
+    col = row < 0 ? -1 : single_col(rhs);
+    if (col < 0)
+    {
+        return -1;
+    }
+
+    // lhs(r, k) is set exactly when column k of lhs is non-empty. The shorter list is walked and probes
+    // the other, stopping at the first shared index.
+    const int64_t *lhs_outer = lhs.outerIndexPtr();
+    const int64_t *rhs_begin = rhs.innerIndexPtr() + rhs.outerIndexPtr()[col];
+    const int64_t *rhs_end = rhs.innerIndexPtr() + rhs.outerIndexPtr()[col + 1];
+    if (rhs_end - rhs_begin <= lhs.nonZeros())
+    {
+        return std::any_of(rhs_begin, rhs_end, [&](int64_t k) { return lhs_outer[k + 1] > lhs_outer[k]; }) ? 1 : 0;
+    }
+
+    // Every column holds at most one nonzero of the row, so nonzero p lies in the last column starting at or before it
+    for (int64_t p = 0, k = 0; p < lhs.nonZeros(); p++)
+    {
+        k = std::upper_bound(lhs_outer + k, lhs_outer + lhs.cols() + 1, p) - lhs_outer - 1;
+        if (std::binary_search(rhs_begin, rhs_end, k))
+        {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+bool parse_product_kernel(const std::string &name, ProductKernel &kernel)
+{
+    if (name == "eigen")
+    {
+        kernel = ProductKernel::Eigen;
+    }
+    else if (name == "gustavson")
+    {
+        kernel = ProductKernel::Gustavson;
+    }
+    else if (name == "bitmap")
+    {
+        kernel = ProductKernel::Bitmap;
+    }
+    else if (name == "hash")
+    {
+        kernel = ProductKernel::Hash;
+    }
+    else if (name == "esc")
+    {
+        kernel = ProductKernel::Esc;
+    }
+    else if (name == "bitmatrix")
+    {
+        kernel = ProductKernel::BitMatrix;
+    }
+    else if (name == "auto")
+    {
+        kernel = ProductKernel::Auto;
+    }
+    else
+    {
+        return false;
+    }
+    return true;
+}
+
+std::string product_kernel_name(ProductKernel kernel)
+{
+    switch (kernel)
+    {
+    case ProductKernel::Eigen:
+        return "eigen";
+    case ProductKernel::Gustavson:
+        return "gustavson";
+    case ProductKernel::Bitmap:
+        return "bitmap";
+    case ProductKernel::Hash:
+        return "hash";
+    case ProductKernel::Esc:
+        return "esc";
+    case ProductKernel::BitMatrix:
+        return "bitmatrix";
+    case ProductKernel::Auto:
+        return "auto";
+    }
+    return "unknown";
+}
+
+void symbolic_product_col_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int64_t *col_nnz, int num_threads)
+{
+    count_columns<MarkerAccumulator>(ProductOperands(lhs, rhs), col_nnz, num_threads);
+}
+
+int64_t symbolic_product_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    int64_t row, col;
+    int nnz = inner_product_nnz(lhs, rhs, row, col);
+    if (nnz >= 0)
+    {
+        return nnz;
+    }
+
+    std::vector<int64_t> col_nnz(rhs.cols());
+    symbolic_product_col_nnz(lhs, rhs, col_nnz.data(), num_threads);
+    return std::accumulate(col_nnz.begin(), col_nnz.end(), int64_t(0));
+}
+
+int64_t product_flops(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs)
+{
+    eigen_assert(lhs.cols() == rhs.rows());
+
+    std::vector<int64_t> rhs_row_nnz(rhs.rows(), 0);
+    for (Eigen::Index j = 0; j < rhs.outerSize(); j++)
+    {
+        for (Eigen::SparseMatrix<bool, 0, int64_t>::InnerIterator it(rhs, j); it; ++it)
+        {
+            rhs_row_nnz[it.row()]++;
+        }
+    }
+
+    int64_t flops = 0;
+    for (int64_t k = 0; k < lhs.cols(); k++)
+    {
+        if (rhs_row_nnz[k] > 0)
+        {
+            flops += lhs.col(k).nonZeros() * rhs_row_nnz[k];
+        }
+    }
+    return flops;
+}
+
+// The inner indices k of lhs * rhs that contribute lhs(:,k) x rhs(k,:), at most 64 of them, and one
+// signature per row of lhs they reach: bit s is set when lhs(:,contributing[s]) holds that row
+struct LowRankFactors
+{
+    std::vector<int64_t> contributing;
+    std::vector<int> slot;
+    std::vector<int64_t> rows;
+    std::vector<uint64_t> signatures;
+    int64_t flops = 0;
+};
+
+// Fills factors in row order, false when more than 64 inner indices contribute
+static bool low_rank_factors(const ProductOperands &operands, int64_t inner_size, int64_t rhs_nnz, LowRankFactors &factors)
+{
+    std::vector<int64_t> rhs_row_nnz(inner_size, 0);
+    for (int64_t p = 0; p < rhs_nnz; p++)
+    {
+        rhs_row_nnz[operands.rhs_inner[p]]++;
+    }
+
+    factors.slot.assign(inner_size, -1);
+    for (int64_t k = 0; k < inner_size; k++)
+    {
+        int64_t lhs_col_nnz = operands.lhs_outer[k + 1] - operands.lhs_outer[k];
+        if (lhs_col_nnz > 0 && rhs_row_nnz[k] > 0)
+        {
+            if (factors.contributing.size() == 64)
+            {
+                return false;
+            }
+            factors.slot[k] = factors.contributing.size();
+            factors.contributing.push_back(k);
+            factors.flops += lhs_col_nnz * rhs_row_nnz[k];
+        }
+    }
+
+    // Only rows of the contributing columns are visited: (row, bit) pairs sorted by row merge into one
+    // signature per row
+    std::vector<std::pair<int64_t, uint64_t>> row_bits;
+    for (size_t s = 0; s < factors.contributing.size(); s++)
+    {
+        int64_t k = factors.contributing[s];
+        for (int64_t q = operands.lhs_outer[k]; q < operands.lhs_outer[k + 1]; q++)
+        {
+            row_bits.emplace_back(operands.lhs_inner[q], uint64_t(1) << s);
+        }
+    }
+    std::sort(row_bits.begin(), row_bits.end());
+
+    for (size_t p = 0; p < row_bits.size(); p++)
+    {
+        if (p == 0 || row_bits[p].first != row_bits[p - 1].first)
+        {
+            factors.rows.push_back(row_bits[p].first);
+            factors.signatures.push_back(0);
+        }
+        factors.signatures.back() |= row_bits[p].second;
+    }
+    return true;
+}
+
+bool analytic_product_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int64_t &nnz)
+{
+    ProductOperands operands(lhs, rhs);
+    LowRankFactors factors;
+    if (!low_rank_factors(operands, lhs.cols(), rhs.nonZeros(), factors))
+    {
+        return false;
+    }
+    const std::vector<int64_t> &contributing = factors.contributing;
+    const std::vector<int> &slot = factors.slot;
+    const int64_t flops = factors.flops;
+
+    nnz = 0;
+    if (contributing.empty())
+    {
+        return true;
+    }
+
+    std::vector<uint64_t> row_signature = std::move(factors.signatures);
+
+    // Sorting groups rows with equal signatures
+    std::sort(row_signature.begin(), row_signature.end());
+    const int64_t touched_rows = row_signature.size();
+    int64_t distinct = 0;
+    for (int64_t i = 0; i < touched_rows; i++)
+    {
+        distinct += i == 0 || row_signature[i] != row_signature[i - 1];
+    }
+
+    // Every distinct signature ORs up to 64 column bitsets; give up when that is not clearly
+    // cheaper than the SpGEMM itself
+    const int64_t col_words = bitset_words(operands.cols);
+    if (distinct * static_cast<int64_t>(contributing.size()) * col_words > flops)
+    {
+        return false;
+    }
+
+    std::vector<uint64_t> col_bits(contributing.size() * col_words, 0);
+    for (int64_t j = 0; j < operands.cols; j++)
+    {
+        for (int64_t p = operands.rhs_outer[j]; p < operands.rhs_outer[j + 1]; p++)
+        {
+            int s = slot[operands.rhs_inner[p]];
+            if (s >= 0)
+            {
+                bitset_set(col_bits.data() + s * col_words, j);
+            }
+        }
+    }
+
+    // Rows sharing a signature get the same product row: the union of the rhs rows they reach
+    std::vector<uint64_t> product_row(col_words);
+    for (int64_t begin = 0, end = 0; begin < touched_rows; begin = end)
+    {
+        uint64_t signature = row_signature[begin];
+        while (end < touched_rows && row_signature[end] == signature)
+        {
+            end++;
+        }
+
+        std::fill(product_row.begin(), product_row.end(), 0);
+        for (uint64_t bits = signature; bits; bits &= bits - 1)
+        {
+            const uint64_t *row_bits = col_bits.data() + __builtin_ctzll(bits) * col_words;
+            for (int64_t w = 0; w < col_words; w++)
+            {
+                product_row[w] |= row_bits[w];
+            }
+        }
+        nnz += (end - begin) * popcount_words(product_row.data(), col_words);
+    }
+
+    return true;
+}
+
+bool analytic_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, Eigen::SparseMatrix<bool, 0, int64_t> &product)
+{
+    ProductOperands operands(lhs, rhs);
+    LowRankFactors factors;
+    if (!low_rank_factors(operands, lhs.cols(), rhs.nonZeros(), factors))
+    {
+        return false;
+    }
+
+    // Output column j holds the rows whose signature meets the contributing rows of rhs(:,j)
+    std::vector<uint64_t> col_mask(operands.cols, 0);
+    for (int64_t j = 0; j < operands.cols; j++)
+    {
+        for (int64_t p = operands.rhs_outer[j]; p < operands.rhs_outer[j + 1]; p++)
+        {
+            int s = factors.slot[operands.rhs_inner[p]];
+            if (s >= 0)
+            {
+                col_mask[j] |= uint64_t(1) << s;
+            }
+        }
+    }
+
+    // Columns with the same mask share one row list; give up when listing them costs more than the flops
+    std::vector<uint64_t> masks(col_mask);
+    std::sort(masks.begin(), masks.end());
+    masks.erase(std::unique(masks.begin(), masks.end()), masks.end());
+    if (static_cast<int64_t>(masks.size()) * static_cast<int64_t>(factors.rows.size()) > factors.flops + operands.cols)
+    {
+        return false;
+    }
+
+    std::vector<int64_t> list_begin(masks.size() + 1, 0), list_rows;
+    for (size_t m = 0; m < masks.size(); m++)
+    {
+        for (size_t r = 0; r < factors.rows.size(); r++)
+        {
+            if (factors.signatures[r] & masks[m])
+            {
+                list_rows.push_back(factors.rows[r]);
+            }
+        }
+        list_begin[m + 1] = list_rows.size();
+    }
+
+    product = Eigen::SparseMatrix<bool, 0, int64_t>(operands.rows, operands.cols);
+    int64_t *outer = product.outerIndexPtr();
+    std::vector<int64_t> col_list(operands.cols);
+    outer[0] = 0;
+    for (int64_t j = 0; j < operands.cols; j++)
+    {
+        col_list[j] = std::lower_bound(masks.begin(), masks.end(), col_mask[j]) - masks.begin();
+        outer[j + 1] = outer[j] + list_begin[col_list[j] + 1] - list_begin[col_list[j]];
+    }
+
+    product.resizeNonZeros(outer[operands.cols]);
+    std::fill_n(product.valuePtr(), outer[operands.cols], true);
+    for (int64_t j = 0; j < operands.cols; j++)
+    {
+        std::copy(list_rows.begin() + list_begin[col_list[j]], list_rows.begin() + list_begin[col_list[j] + 1], product.innerIndexPtr() + outer[j]);
+    }
+    return true;
+}
+
+ProductStatistics product_statistics(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs)
+{
+    ProductOperands operands(lhs, rhs);
+
+    ProductStatistics statistics = {};
+    statistics.rows = operands.rows;
+    statistics.cols = operands.cols;
+    statistics.inner_size = lhs.cols();
+
+    std::vector<bool> rhs_row_used(lhs.cols(), false);
+    int64_t estimate_sum = 0, active_cols = 0;
+    for (int64_t j = 0; j < operands.cols; j++)
+    {
+        int64_t col_flops = operands.column_flops(j);
+        for (int64_t p = operands.rhs_outer[j]; p < operands.rhs_outer[j + 1]; p++)
+        {
+            rhs_row_used[operands.rhs_inner[p]] = true;
+        }
+        if (col_flops == 0)
+        {
+            continue;
+        }
+
+        int64_t estimate = std::min(col_flops, operands.rows);
+        statistics.flops += col_flops;
+        statistics.max_col_flops = std::max(statistics.max_col_flops, col_flops);
+        statistics.max_col_estimate = std::max(statistics.max_col_estimate, estimate);
+        estimate_sum += estimate;
+        active_cols++;
+    }
+    statistics.avg_col_estimate = active_cols > 0 ? static_cast<double>(estimate_sum) / active_cols : 0.0;
+
+    int64_t nonempty_lhs_cols = 0;
+    for (int64_t k = 0; k < lhs.cols(); k++)
+    {
+        bool nonempty = operands.lhs_outer[k + 1] > operands.lhs_outer[k];
+        nonempty_lhs_cols += nonempty;
+        statistics.inner_dimension += nonempty && rhs_row_used[k];
+    }
+    statistics.avg_lhs_col_nnz = nonempty_lhs_cols > 0 ? static_cast<double>(lhs.nonZeros()) / nonempty_lhs_cols : 0.0;
+
+    return statistics;
+}
+
+// ESC is chosen only below both bounds: more inner indices make the expanded pairs collide, so an
+// accumulator does less work, and its keys plus radix buffer must stay within the memory cap
+static constexpr int64_t esc_max_inner_dimension = 64;
+static constexpr int64_t esc_memory_cap = int64_t(64) << 20;
+
+ProductKernel select_product_kernel(const ProductStatistics &statistics, std::string &reason)
+{
+    const int64_t col_words = bitset_words(statistics.rows);
+
+    // OR-ing a packed lhs column costs rows / 64 words against one scattered update per lhs nonzero
+    if (statistics.avg_lhs_col_nnz * 2 >= col_words && statistics.inner_size * col_words <= (int64_t(1) << 24))
+    {
+        reason = "dense lhs columns (" + std::to_string(statistics.avg_lhs_col_nnz) + " nnz per column vs " + std::to_string(col_words) + " words per packed column)";
+        return ProductKernel::BitMatrix;
+    }
+
+    if (statistics.avg_col_estimate * 64 >= statistics.rows)
+    {
+        reason = "output columns fill the bitmap (" + std::to_string(statistics.avg_col_estimate) + " estimated nnz per column, " + std::to_string(statistics.rows) + " rows)";
+        return ProductKernel::Bitmap;
+    }
+
+    // Sparse output columns from few inner indices, as in outer products: the expanded pairs rarely
+    // collide, so sorting them costs only the flops, independent of rows. Keys and the radix buffer take
+    // 16 bytes per flop, held for every concurrent product, so ESC is capped by memory.
+    const int64_t esc_bytes = statistics.flops * static_cast<int64_t>(sizeof(uint64_t)) * 2;
+    if (statistics.inner_dimension <= esc_max_inner_dimension && esc_bytes <= esc_memory_cap)
+    {
+        reason = "sparse output columns with " + std::to_string(statistics.flops) + " flops over inner dimension " + std::to_string(statistics.inner_dimension)
+               + ", expand-sort-compress needs " + std::to_string(esc_bytes >> 20) + " MiB and is cheaper than row-sized scratch";
+        return ProductKernel::Esc;
+    }
+
+    // Too many flops to expand, and a dense row array per thread would no longer fit in cache
+    if (statistics.rows > (1 << 20))
+    {
+        reason = "output columns tiny against " + std::to_string(statistics.rows) + " rows (" + std::to_string(statistics.avg_col_estimate) + " estimated nnz per column)";
+        return ProductKernel::Hash;
+    }
+
+    reason = "sparse output columns (" + std::to_string(statistics.avg_col_estimate) + " estimated nnz per column, inner dimension " + std::to_string(statistics.inner_dimension) + ")";
+    return ProductKernel::Gustavson;
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> gustavson_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    return two_pass_product<MarkerAccumulator>(ProductOperands(lhs, rhs), num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> bitmap_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    return two_pass_product<BitmapAccumulator>(ProductOperands(lhs, rhs), num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> hash_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    return two_pass_product<HashAccumulator>(ProductOperands(lhs, rhs), num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> bit_matrix_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    return two_pass_product<DenseBitAccumulator>(BitMatrixOperands(lhs, rhs, num_threads), num_threads);
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> esc_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads)
+{
+    ProductOperands operands(lhs, rhs);
+    const int64_t rows = operands.rows;
+    const int64_t cols = operands.cols;
+    const int64_t inner_size = lhs.cols();
+
+    if (operands.operand_nnz < (1 << 15))
+    {
+        num_threads = 1;
+    }
+
+    // Row-major structure of rhs, so every inner index k expands lhs(:,k) x rhs(k,:) in one go
+    std::vector<int64_t> rhs_row_outer(inner_size + 1, 0);
+    std::vector<int64_t> rhs_row_cols(rhs.nonZeros());
+    for (int64_t p = 0; p < rhs.nonZeros(); p++)
+    {
+        rhs_row_outer[operands.rhs_inner[p] + 1]++;
+    }
+    std::partial_sum(rhs_row_outer.begin(), rhs_row_outer.end(), rhs_row_outer.begin());
+    {
+        std::vector<int64_t> cursor(rhs_row_outer.begin(), rhs_row_outer.end() - 1);
+        for (int64_t j = 0; j < cols; j++)
+        {
+            for (int64_t p = operands.rhs_outer[j]; p < operands.rhs_outer[j + 1]; p++)
+            {
+                rhs_row_cols[cursor[operands.rhs_inner[p]]++] = j;
+            }
+        }
+    }
+
+    // Expand: every (i, j) pair becomes the column-major key j * rows + i
+    std::vector<int64_t> expand_offset(inner_size + 1, 0);
+    for (int64_t k = 0; k < inner_size; k++)
+    {
+        expand_offset[k + 1] = expand_offset[k] + (operands.lhs_outer[k + 1] - operands.lhs_outer[k]) * (rhs_row_outer[k + 1] - rhs_row_outer[k]);
+    }
+    const int64_t flops = expand_offset[inner_size];
+
+    std::vector<uint64_t> keys(flops);
+    parallel_for(inner_size, column_grain(inner_size, num_threads), num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t k = begin; k < end; k++)
+        {
+            uint64_t *out = keys.data() + expand_offset[k];
+            for (int64_t p = rhs_row_outer[k]; p < rhs_row_outer[k + 1]; p++)
+            {
+                uint64_t base = static_cast<uint64_t>(rhs_row_cols[p]) * rows;
+                for (int64_t q = operands.lhs_outer[k]; q < operands.lhs_outer[k + 1]; q++)
+                {
+                    *out++ = base + operands.lhs_inner[q];
+                }
+            }
+        }
+    });
+
+    // Sort. Every k expands into an already sorted run, so a single contributing k (a rank-one
+    // product) needs no sort at all
+    int64_t runs = 0;
+    for (int64_t k = 0; k < inner_size && runs < 2; k++)
+    {
+        runs += expand_offset[k + 1] > expand_offset[k];
+    }
+    std::vector<uint64_t> buffer(flops);
+    if (runs > 1)
+    {
+        int key_bits = 0;
+        while (key_bits < 64 && (uint64_t(1) << key_bits) < static_cast<uint64_t>(rows) * cols)
+        {
+            key_bits++;
+        }
+        radix_sort(keys, buffer, key_bits, num_threads);
+    }
+
+    // Compress: every block counts its distinct keys, then writes them at its prefix offset
+    const int64_t block = std::max(int64_t(1 << 16), flops / std::max(1, parallel_thread_count(flops, 1, num_threads)));
+    const int64_t block_count = (flops + block - 1) / block;
+    std::vector<int64_t> block_offset(block_count + 1, 0);
+    parallel_for(flops, block, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        int64_t distinct = 0;
+        for (int64_t p = begin; p < end; p++)
+        {
+            distinct += p == 0 || keys[p] != keys[p - 1];
+        }
+        block_offset[begin / block + 1] = distinct;
+    });
+    std::partial_sum(block_offset.begin(), block_offset.end(), block_offset.begin());
+    const int64_t nnz = block_offset[block_count];
+
+    Eigen::SparseMatrix<bool, 0, int64_t> result(rows, cols);
+    result.resizeNonZeros(nnz);
+    std::fill_n(result.valuePtr(), nnz, true);
+    int64_t *inner = result.innerIndexPtr();
+    int64_t *outer = result.outerIndexPtr();
+
+    // The distinct keys are kept in buffer so column starts can be found by binary search
+    parallel_for(flops, block, num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        int64_t out = block_offset[begin / block];
+        for (int64_t p = begin; p < end; p++)
+        {
+            if (p == 0 || keys[p] != keys[p - 1])
+            {
+                buffer[out] = keys[p];
+                inner[out] = static_cast<int64_t>(keys[p] % rows);
+                out++;
+            }
+        }
+    });
+
+    parallel_for(cols + 1, column_grain(cols + 1, num_threads), num_threads, [&](int64_t begin, int64_t end, int)
+    {
+        for (int64_t j = begin; j < end; j++)
+        {
+            outer[j] = std::lower_bound(buffer.begin(), buffer.begin() + nnz, static_cast<uint64_t>(j) * rows) - buffer.begin();
+        }
+    });
+
+    return result;
+}
+
+Eigen::SparseMatrix<bool, 0, int64_t> sparse_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, ProductKernel kernel, int num_threads)
+{
+    // Eigen stays the untouched reference path
+    int64_t row, col;
+    int nnz = kernel == ProductKernel::Eigen ? -1 : inner_product_nnz(lhs, rhs, row, col);
+    if (nnz >= 0)
+    {
+        Eigen::SparseMatrix<bool, 0, int64_t> result(lhs.rows(), rhs.cols());
+        if (nnz == 1)
+        {
+            result.insert(row, col) = true;
+            result.makeCompressed();
+        }
+        return result;
+    }
+
+    switch (kernel)
+    {
+    case ProductKernel::Gustavson:
+        return gustavson_product(lhs, rhs, num_threads);
+    case ProductKernel::Bitmap:
+        return bitmap_product(lhs, rhs, num_threads);
+    case ProductKernel::Hash:
+        return hash_product(lhs, rhs, num_threads);
+    case ProductKernel::Esc:
+        return esc_product(lhs, rhs, num_threads);
+    case ProductKernel::BitMatrix:
+        return bit_matrix_product(lhs, rhs, num_threads);
+    case ProductKernel::Auto:
+    {
+        std::string reason;
+        return sparse_product(lhs, rhs, select_product_kernel(product_statistics(lhs, rhs), reason), num_threads);
+    }
+    case ProductKernel::Eigen:
+        break;
+    }
+    return lhs * rhs;
+}
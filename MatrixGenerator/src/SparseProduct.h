@@ -0,0 +1,93 @@
+#ifndef SPARSE_PRODUCT_H
+#define SPARSE_PRODUCT_H
+
+#include <Eigen/SparseCore>
+#include <cstdint>
+#include <string>
+
+enum class ProductKernel
+{
+    Eigen,      // Eigen's single-threaded conservative_sparse_sparse_product
+    Gustavson,  // column-parallel Gustavson with a per-thread marker accumulator
+    Bitmap,     // column-parallel Gustavson with a per-thread bitset accumulator counted by popcount
+    Hash,       // column-parallel Gustavson with a per-thread open-addressing hash accumulator
+    Esc,        // parallel expand-sort-compress over the inner dimension
+    BitMatrix,  // lhs packed as a dense bit matrix, output columns formed by OR-ing whole lhs columns
+    Auto,       // picked per product by select_product_kernel
+};
+
+// Structural statistics of a product, gathered in O(nnz(lhs) + nnz(rhs) + lhs.cols() + rhs.cols())
+struct ProductStatistics
+{
+    int64_t rows, cols, inner_size;
+    int64_t flops;                 // sum over k of nnz(lhs(:,k)) * nnz(rhs(k,:)), an upper bound of the product nnz
+    int64_t max_col_flops;         // largest flop count of a single output column
+    int64_t max_col_estimate;      // largest output column estimate, min(column flops, rows)
+    double avg_col_estimate;       // output column estimate averaged over columns with any flops
+    int64_t inner_dimension;       // inner indices k with both lhs(:,k) and rhs(k,:) nonempty
+    double avg_lhs_col_nnz;        // nonzeros per nonempty lhs column
+};
+
+ProductStatistics product_statistics(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs);
+
+// Chooses a kernel for the product from its statistics and describes why in reason.
+ProductKernel select_product_kernel(const ProductStatistics &statistics, std::string &reason);
+
+// Maps a kernel name ("eigen", "gustavson", "bitmap", "hash", "esc", "bitmatrix", "auto") to its ProductKernel, returns false for unknown names.
+bool parse_product_kernel(const std::string &name, ProductKernel &kernel);
+
+std::string product_kernel_name(ProductKernel kernel);
+
+// Number of structural nonzeros of lhs * rhs without building the product.
+// Only one marker array of lhs.rows() entries per thread is allocated.
+// num_threads = 0 uses every hardware thread.
+int64_t symbolic_product_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads = 0);
+
+// sum over k of nnz(lhs(:,k)) * nnz(rhs(k,:)): the work of any Gustavson-style product and an upper
+// bound of its nnz, computed from column and row counts in O(nnz(rhs) + lhs.cols()).
+int64_t product_flops(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs);
+
+// Closed-form product nnz for factors of low effective rank, without running SpGEMM. The product is
+// the union of lhs(:,k) x rhs(k,:) over the inner indices k that contribute; when there are at most 64
+// of them, rows of lhs hit by the same set of k share one product row, so
+// nnz = sum over those row groups of (group size) * |union of their rhs rows|.
+// This is exact for rank-one factors (one column times one row gives nnz(lhs(:,k)) * nnz(rhs(k,:)))
+// and for the extreme-case shapes whose selected columns of lhs and rows of rhs overlap in at most 64
+// indices; wider overlaps have no cheaper closed form and return false, as do shapes whose row groups
+// would cost more than the flops. Work is O(nnz(lhs) log nnz(lhs) + nnz(rhs) + inner size).
+bool analytic_product_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int64_t &nnz);
+
+// Builds the product of the same low-rank factors in closed form: output columns whose rhs column meets
+// the same contributing indices share one row list, taken from the row signatures above. Returns false,
+// leaving product untouched, for more than 64 contributing indices or when those row lists would cost
+// more than the flops.
+bool analytic_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, Eigen::SparseMatrix<bool, 0, int64_t> &product);
+
+// Structural nonzeros of every column of lhs * rhs.
+void symbolic_product_col_nnz(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int64_t *col_nnz, int num_threads);
+
+// Column-parallel Gustavson product. Column sizes come from a symbolic pass, so every thread
+// writes its columns straight into the final CSC arrays and no global sort is needed.
+Eigen::SparseMatrix<bool, 0, int64_t> gustavson_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads);
+
+// Gustavson product whose accumulator is a bitset of the output column. Rows come out of the
+// bitset already sorted and only the touched words are cleared between columns.
+Eigen::SparseMatrix<bool, 0, int64_t> bitmap_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads);
+
+// Gustavson product whose accumulator is a hash table sized from each column's flop count.
+// Suited to very sparse products with many rows, where a dense marker per thread wastes cache.
+Eigen::SparseMatrix<bool, 0, int64_t> hash_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads);
+
+// Expand-sort-compress product: every inner index k expands lhs(:,k) x rhs(k,:) into column-major
+// keys, which are radix sorted and deduplicated straight into CSC. Work and memory follow the flop
+// count, so it suits low inner dimensions such as outer products, where flops equal the output size.
+Eigen::SparseMatrix<bool, 0, int64_t> esc_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads);
+
+// Dense bit-matrix product: lhs is packed into one bitset per column and every output column is the
+// word-wise OR of the lhs columns its rhs column selects. Costs lhs.cols() * lhs.rows() / 8 bytes and
+// rows / 64 words per rhs nonzero, which pays off once lhs columns hold more than about rows / 64 nonzeros.
+Eigen::SparseMatrix<bool, 0, int64_t> bit_matrix_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, int num_threads);
+
+Eigen::SparseMatrix<bool, 0, int64_t> sparse_product(const Eigen::SparseMatrix<bool, 0, int64_t> &lhs, const Eigen::SparseMatrix<bool, 0, int64_t> &rhs, ProductKernel kernel, int num_threads);
+
+#endif // SPARSE_PRODUCT_H
@@ -1,33 +1,474 @@
 #include "Utilities.h"
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <string_view>
+
+#include "Parallel.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 
 std::string current_timestamp()
 {
     auto now = std::chrono::system_clock::now();
     auto seconds_since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(now.time_since_epoch()).count();
-    auto random_number = std::rand() % 1000;
-    return std::to_string(seconds_since_epoch) + std::to_string(random_number);
+    // A process-wide counter instead of std::rand, which is not safe to call from writer threads
+    static std::atomic<uint64_t> sequence(0);
+    return std::to_string(seconds_since_epoch) + std::to_string(sequence++ % 1000);
 }
 
+Eigen::SparseMatrix<bool, 0, int64_t> build_pattern_matrix(int64_t rows, int64_t cols, const std::vector<std::pair<int64_t, int64_t>> &cells)
+{
+    Eigen::SparseMatrix<bool, 0, int64_t> matrix(rows, cols);
+    int64_t *outer = matrix.outerIndexPtr();
+
+    for (const auto &cell : cells)
+    {
+        outer[cell.second + 1]++;
+    }
+    std::partial_sum(outer, outer + cols + 1, outer);
+
+    matrix.resizeNonZeros(cells.size());
+    std::fill_n(matrix.valuePtr(), cells.size(), true);
+    int64_t *inner = matrix.innerIndexPtr();
+
+    std::vector<int64_t> cursor(outer, outer + cols);
+    for (const auto &cell : cells)
+    {
+        inner[cursor[cell.second]++] = cell.first;
+    }
+    for (int64_t col = 0; col < cols; col++)
+    {
+        std::sort(inner + outer[col], inner + outer[col + 1]);
+    }
+
+    return matrix;
+}
+
+// Formats lines into a large buffer and hands it to the stream in one write per buffer
+class MatrixMarketWriter
+{
+public:
+    explicit MatrixMarketWriter(std::ofstream &file) : file(file), buffer(buffer_size) {}
+
+    ~MatrixMarketWriter()
+    {
+        flush();
+    }
+
+    void write(std::string_view text)
+    {
+        reserve(text.size());
+        std::copy(text.begin(), text.end(), buffer.data() + used);
+        used += text.size();
+    }
+
+    // An integer followed by a separator, the widest being 20 digits and a sign
+    void write(int64_t value, char separator)
+    {
+        reserve(24);
+        // The last byte is kept for the separator; a failed conversion fails the stream, which
+        // save_matrix reports
+        auto result = std::to_chars(buffer.data() + used, buffer.data() + buffer.size() - 1, value);
+        if (result.ec != std::errc())
+        {
+            file.setstate(std::ios::failbit);
+            return;
+        }
+        used = result.ptr - buffer.data();
+        buffer[used++] = separator;
+    }
+
+    void flush()
+    {
+        file.write(buffer.data(), used);
+        used = 0;
+    }
+
+private:
+    static constexpr size_t buffer_size = size_t(1) << 20;
+
+    void reserve(size_t size)
+    {
+        if (used + size > buffer.size())
+        {
+            flush();
+        }
+    }
+
+    std::ofstream &file;
+    std::vector<char> buffer;
+    size_t used = 0;
+};
+
 bool save_matrix(std::filesystem::path path, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
 {
-    std::ofstream file(path);
+    std::ofstream file(path, std::ios::binary);
+    if (!file.is_open())
+    {
+        return false;
+    }
+
+    // Every stored value is 1, so the pattern field lets entries skip the value column
+    {
+        MatrixMarketWriter writer(file);
+        writer.write("%%MatrixMarket matrix coordinate pattern general\n");
+        writer.write(matrix.rows(), ' ');
+        writer.write(matrix.cols(), ' ');
+        writer.write(matrix.nonZeros(), '\n');
+
+        const int64_t *outer = matrix.outerIndexPtr();
+        const int64_t *inner = matrix.innerIndexPtr();
+        for (int64_t col = 0; col < matrix.outerSize(); col++)
+        {
+            for (int64_t k = outer[col]; k < outer[col + 1]; k++)
+            {
+                writer.write(inner[k] + 1, ' ');
+                writer.write(col + 1, '\n');
+            }
+        }
+    }
+
+    return static_cast<bool>(file);
+}
+
+static const char *skip_blanks(const char *p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    {
+        p++;
+    }
+    return p;
+}
+
+// End of the line starting at p, at its newline or at end
+static const char *line_end(const char *p, const char *end)
+{
+    const char *newline = static_cast<const char *>(std::memchr(p, '\n', end - p));
+    return newline != nullptr ? newline : end;
+}
+
+// Parses the "row col [value]" lines of [begin, end), skipping blank and comment lines. Returns the first
+// malformed or out of range line, or nullptr when all of them parsed.
+static const char *parse_coordinate_lines(const char *begin, const char *end, int64_t rows, int64_t cols,
+                                          std::vector<int64_t> &row_indices, std::vector<int64_t> &col_indices)
+{
+    for (const char *line = begin; line < end;)
+    {
+        const char *last = line_end(line, end);
+        const char *p = skip_blanks(line, last);
+        if (p < last && *p != '%')
+        {
+            int64_t row = 0, col = 0;
+            auto [row_end, row_error] = std::from_chars(p, last, row);
+            auto [col_end, col_error] = std::from_chars(skip_blanks(row_end, last), last, col);
+            if (row_error != std::errc() || col_error != std::errc() || row < 1 || row > rows || col < 1 || col > cols)
+            {
+                return line;
+            }
+            row_indices.push_back(row - 1);
+            col_indices.push_back(col - 1);
+        }
+        line = last + 1;
+    }
+    return nullptr;
+}
+
+bool read_matrix_market(std::filesystem::path path, MatrixMarketIndices &indices, int num_threads)
+{
+    MappedFile file;
+    if (!file.open(path))
+    {
+        return false;
+    }
+    const char *p = file.data();
+    const char *end = p + file.size();
+
+    std::string_view banner(p, line_end(p, end) - p);
+    if (banner.rfind("%%MatrixMarket", 0) != 0 || banner.find("coordinate") == std::string_view::npos)
+    {
+        std::cerr << path << " is not a MatrixMarket coordinate file" << std::endl;
+        return false;
+    }
+
+    // The size line is the first one after the comments
+    int64_t nnz = -1;
+    while (p < end && nnz < 0)
+    {
+        const char *last = line_end(p, end);
+        const char *token = skip_blanks(p, last);
+        if (token < last && *token != '%')
+        {
+            auto rows_parsed = std::from_chars(token, last, indices.rows);
+            auto cols_parsed = std::from_chars(skip_blanks(rows_parsed.ptr, last), last, indices.cols);
+            auto nnz_parsed = std::from_chars(skip_blanks(cols_parsed.ptr, last), last, nnz);
+            if (rows_parsed.ec != std::errc() || cols_parsed.ec != std::errc() || nnz_parsed.ec != std::errc() || nnz < 0)
+            {
+                std::cerr << "Malformed size line in " << path << std::endl;
+                return false;
+            }
+        }
+        p = last + 1;
+    }
+    if (nnz < 0)
+    {
+        std::cerr << path << " has no size line" << std::endl;
+        return false;
+    }
+    const char *body = std::min(p, end);
+
+    // At least 1 MiB per chunk, a few chunks per thread so uneven lines still balance; every boundary
+    // is moved past the next newline so chunks start on whole lines
+    const int64_t body_size = end - body;
+    const int64_t chunk_count = std::max<int64_t>(1, std::min<int64_t>(body_size >> 20, 4 * (num_threads > 0 ? num_threads : default_thread_count())));
+    std::vector<const char *> boundaries(chunk_count + 1, end);
+    boundaries[0] = body;
+    for (int64_t chunk = 1; chunk < chunk_count; chunk++)
+    {
+        const char *last = line_end(std::max(body + body_size * chunk / chunk_count - 1, boundaries[chunk - 1]), end);
+        boundaries[chunk] = last < end ? last + 1 : end;
+    }
+
+    std::vector<std::vector<int64_t>> chunk_rows(chunk_count), chunk_cols(chunk_count);
+    std::vector<const char *> malformed(chunk_count, nullptr);
+    parallel_for(chunk_count, 1, num_threads, [&](int64_t begin, int64_t stop, int)
+    {
+        for (int64_t chunk = begin; chunk < stop; chunk++)
+        {
+            // Reserve by the chunk's share of the header count
+            const int64_t expected = body_size > 0 ? nnz * (boundaries[chunk + 1] - boundaries[chunk]) / body_size + 16 : 0;
+            chunk_rows[chunk].reserve(expected);
+            chunk_cols[chunk].reserve(expected);
+            malformed[chunk] = parse_coordinate_lines(boundaries[chunk], boundaries[chunk + 1], indices.rows, indices.cols, chunk_rows[chunk], chunk_cols[chunk]);
+        }
+    });
+
+    for (const char *line : malformed)
+    {
+        if (line != nullptr)
+        {
+            std::cerr << "Malformed entry \"" << std::string_view(line, line_end(line, end) - line) << "\" in " << path << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<int64_t> chunk_offsets(chunk_count + 1, 0);
+    for (int64_t chunk = 0; chunk < chunk_count; chunk++)
+    {
+        chunk_offsets[chunk + 1] = chunk_offsets[chunk] + static_cast<int64_t>(chunk_rows[chunk].size());
+    }
+    if (chunk_offsets[chunk_count] != nnz)
+    {
+        std::cerr << path << " has " << chunk_offsets[chunk_count] << " entries, its header says " << nnz << std::endl;
+        return false;
+    }
+
+    indices.row_indices.resize(nnz);
+    indices.col_indices.resize(nnz);
+    parallel_for(chunk_count, 1, num_threads, [&](int64_t begin, int64_t stop, int)
+    {
+        for (int64_t chunk = begin; chunk < stop; chunk++)
+        {
+            std::copy(chunk_rows[chunk].begin(), chunk_rows[chunk].end(), indices.row_indices.begin() + chunk_offsets[chunk]);
+            std::copy(chunk_cols[chunk].begin(), chunk_cols[chunk].end(), indices.col_indices.begin() + chunk_offsets[chunk]);
+        }
+    });
+    return true;
+}
+
+static const char binary_matrix_magic[8] = {'S', 'P', 'M', 'D', 'C', 'S', 'C', '1'};
+
+uint64_t align_offset(uint64_t offset)
+{
+    return (offset + 63) / 64 * 64;
+}
+
+uint64_t write_binary_matrix(std::ostream &file, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
+{
+    BinaryMatrixHeader header = {};
+    std::memcpy(header.magic, binary_matrix_magic, sizeof(header.magic));
+    header.index_width = sizeof(int64_t);
+    header.value_width = sizeof(bool);
+    header.rows = matrix.rows();
+    header.cols = matrix.cols();
+    header.nnz = matrix.nonZeros();
+    header.outer_offset = align_offset(sizeof(header));
+    header.inner_offset = align_offset(header.outer_offset + (header.cols + 1) * sizeof(int64_t));
+    header.value_offset = align_offset(header.inner_offset + header.nnz * sizeof(int64_t));
+
+    // Each array is written whole after zero padding up to its offset
+    const char padding[64] = {};
+    uint64_t written = 0;
+    auto write_at = [&](uint64_t offset, const void *array, uint64_t bytes)
+    {
+        file.write(padding, offset - written);
+        file.write(static_cast<const char *>(array), bytes);
+        written = offset + bytes;
+    };
+
+    write_at(0, &header, sizeof(header));
+    write_at(header.outer_offset, matrix.outerIndexPtr(), (header.cols + 1) * sizeof(int64_t));
+    write_at(header.inner_offset, matrix.innerIndexPtr(), header.nnz * sizeof(int64_t));
+    write_at(header.value_offset, matrix.valuePtr(), header.nnz * sizeof(bool));
+    file.write(padding, align_offset(written) - written);
+
+    return align_offset(written);
+}
+
+bool binary_matrix_valid(const char *record, uint64_t size)
+{
+    if (size < sizeof(BinaryMatrixHeader))
+    {
+        return false;
+    }
+
+    const BinaryMatrixHeader &header = *reinterpret_cast<const BinaryMatrixHeader *>(record);
+    auto fits = [&](uint64_t offset, int64_t count, uint64_t width)
+    {
+        return offset % 64 == 0 && count >= 0 && offset <= size && static_cast<uint64_t>(count) <= (size - offset) / width;
+    };
+    if (std::memcmp(header.magic, binary_matrix_magic, sizeof(header.magic)) != 0
+        || header.index_width != sizeof(int64_t) || header.value_width != sizeof(bool)
+        || header.rows < 0 || header.cols < 0 || header.cols == INT64_MAX
+        || !fits(header.outer_offset, header.cols + 1, sizeof(int64_t))
+        || !fits(header.inner_offset, header.nnz, sizeof(int64_t))
+        || !fits(header.value_offset, header.nnz, sizeof(bool)))
+    {
+        return false;
+    }
+
+    // The whole structure is checked so that a truncated or corrupt record cannot send a reader out of
+    // bounds: the outer index climbs from 0 to nnz and every column holds increasing rows below rows
+    const int64_t *outer = reinterpret_cast<const int64_t *>(record + header.outer_offset);
+    const int64_t *inner = reinterpret_cast<const int64_t *>(record + header.inner_offset);
+    if (outer[0] != 0 || outer[header.cols] != header.nnz)
+    {
+        return false;
+    }
+    for (int64_t j = 0; j < header.cols; j++)
+    {
+        if (outer[j + 1] < outer[j] || outer[j + 1] > header.nnz)
+        {
+            return false;
+        }
+        for (int64_t p = outer[j]; p < outer[j + 1]; p++)
+        {
+            if (inner[p] < 0 || inner[p] >= header.rows || (p > outer[j] && inner[p] <= inner[p - 1]))
+            {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> binary_matrix_map(const char *record)
+{
+    // Without a record the map is an empty 0 x 0 matrix, which still needs its one outer index entry
+    static const int64_t empty_outer = 0;
+    if (record == nullptr)
+    {
+        return Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>>(0, 0, 0, &empty_outer, nullptr, nullptr);
+    }
+
+    const BinaryMatrixHeader &header = *reinterpret_cast<const BinaryMatrixHeader *>(record);
+    return Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>>(header.rows, header.cols, header.nnz,
+                                    reinterpret_cast<const int64_t *>(record + header.outer_offset),
+                                    reinterpret_cast<const int64_t *>(record + header.inner_offset),
+                                    reinterpret_cast<const bool *>(record + header.value_offset));
+}
+
+bool save_matrix_binary(std::filesystem::path path, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix)
+{
+    std::ofstream file(path, std::ios::binary);
     if (!file.is_open())
     {
         return false;
     }
 
-    file << "%%MatrixMarket matrix coordinate real general" << std::endl;
+    write_binary_matrix(file, matrix);
+    return static_cast<bool>(file);
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
 
-    file << matrix.rows() << " " << matrix.cols() << " " << matrix.nonZeros() << std::endl;
+bool MappedFile::open(std::filesystem::path path)
+{
+    close();
 
-    for (int k = 0; k < matrix.outerSize(); ++k)
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
     {
-        for (Eigen::SparseMatrix<bool, 0, int64_t>::InnerIterator it(matrix, k); it; ++it)
+        std::cerr << "Failed to open " << path << std::endl;
+        return false;
+    }
+
+    struct stat status;
+    if (fstat(fd, &status) != 0)
+    {
+        std::cerr << "Failed to read the size of " << path << std::endl;
+        ::close(fd);
+        return false;
+    }
+
+    // An empty file maps to no data but still opens
+    if (status.st_size > 0)
+    {
+        void *mapped = mmap(nullptr, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
         {
-            file << it.row() + 1 << " " << it.col() + 1 << " " << it.value() << std::endl;
+            std::cerr << "Failed to map " << path << std::endl;
+            ::close(fd);
+            return false;
         }
+        mapping = mapped;
+        length = status.st_size;
     }
+    ::close(fd);
+    return true;
+}
 
+void MappedFile::close()
+{
+    if (mapping != nullptr)
+    {
+        munmap(mapping, length);
+        mapping = nullptr;
+        length = 0;
+    }
+}
+
+bool MappedMatrix::open(std::filesystem::path path)
+{
+    if (!file.open(path))
+    {
+        return false;
+    }
+    if (!binary_matrix_valid(file.data(), file.size()))
+    {
+        std::cerr << path << " is not a well-formed binary matrix with 8-byte indices" << std::endl;
+        file.close();
+        return false;
+    }
     return true;
 }
+
+void MappedMatrix::close()
+{
+    file.close();
+}
+
+Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> MappedMatrix::matrix() const
+{
+    return binary_matrix_map(file.data());
+}
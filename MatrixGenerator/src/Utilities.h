@@ -2,11 +2,98 @@
 #define UTILITIES_H
 
 #include <Eigen/Sparse>
+#include <cstdint>
 #include <filesystem>
 #include <fstream>
+#include <utility>
+#include <vector>
 
+// Nanoseconds since the epoch followed by a per-process sequence number; safe to call from any thread
 std::string current_timestamp();
 
+// Builds a pattern matrix straight into CSC storage from unique (row, col) cells in any order:
+// a counting pass over columns fills outerIndexPtr, rows are scattered into innerIndexPtr and
+// sorted per column. Unlike setFromTriplets there is no triplet copy and no duplicate handling.
+Eigen::SparseMatrix<bool, 0, int64_t> build_pattern_matrix(int64_t rows, int64_t cols, const std::vector<std::pair<int64_t, int64_t>> &cells);
+
+// Writes a compressed matrix as a MatrixMarket pattern file (1-based "row col" lines, no value column),
+// formatted with std::to_chars into a large buffer instead of one stream insertion per token.
 bool save_matrix(std::filesystem::path path, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix);
 
-#endif // UTILITIES_H
\ No newline at end of file
+// Indices of a MatrixMarket coordinate file, converted to 0-based and kept in file order
+struct MatrixMarketIndices
+{
+    int64_t rows = 0, cols = 0;
+    std::vector<int64_t> row_indices, col_indices;
+};
+
+// Reads a MatrixMarket coordinate file, pattern or with a value column that is skipped. The mapped body is
+// split into chunks at line starts that num_threads threads (0 for all) parse with std::from_chars.
+// Returns false on a malformed line, an index out of range or an entry count that differs from the header.
+bool read_matrix_market(std::filesystem::path path, MatrixMarketIndices &indices, int num_threads = 0);
+
+// Binary CSC file: this header, then the outer index, inner index and value arrays in native byte order,
+// each starting on a 64-byte boundary so a mapped file can be used in place
+struct BinaryMatrixHeader
+{
+    char magic[8];
+    uint32_t index_width, value_width;
+    int64_t rows, cols, nnz;
+    uint64_t outer_offset, inner_offset, value_offset;
+};
+
+static_assert(sizeof(BinaryMatrixHeader) == 64, "BinaryMatrixHeader must fill one 64-byte line");
+
+// Writes a compressed matrix as a binary CSC file with 8-byte indices and 1-byte values
+bool save_matrix_binary(std::filesystem::path path, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix);
+
+// The same layout as a record inside a larger file: offsets are relative to the record start, which must
+// sit on a 64-byte boundary, and the record is padded to one. Returns the bytes written.
+uint64_t write_binary_matrix(std::ostream &file, const Eigen::SparseMatrix<bool, 0, int64_t> &matrix);
+
+// Whether the size bytes at record start with a well-formed binary matrix that fits in them: a valid
+// header, an outer index climbing from 0 to nnz and increasing rows below rows in every column. O(nnz).
+bool binary_matrix_valid(const char *record, uint64_t size);
+
+// Wraps a valid record without copying it, or an empty matrix for nullptr
+Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> binary_matrix_map(const char *record);
+
+// Next 64-byte boundary at or after offset
+uint64_t align_offset(uint64_t offset);
+
+// A file mapped read-only into memory until it is closed or another one is opened
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool open(std::filesystem::path path);
+    void close();
+
+    const char *data() const { return static_cast<const char *>(mapping); }
+    uint64_t size() const { return length; }
+
+private:
+    void *mapping = nullptr;
+    uint64_t length = 0;
+};
+
+// A binary CSC file mapped read-only into memory. matrix() wraps the mapped arrays without copying them
+// and stays valid until the file is closed or another one is opened.
+class MappedMatrix
+{
+public:
+    // Maps the file and checks its whole structure with binary_matrix_valid, returns false on failure
+    bool open(std::filesystem::path path);
+    void close();
+
+    Eigen::Map<const Eigen::SparseMatrix<bool, 0, int64_t>> matrix() const;
+
+private:
+    MappedFile file;
+};
+
+#endif // UTILITIES_H